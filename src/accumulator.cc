@@ -0,0 +1,341 @@
+#include <math.h>
+#include <string.h>
+
+#include "accumulator.hh"
+#include "topology.hh"
+
+namespace {
+
+const uint32_t maxCount = 65535;
+const float maxRgb9e5 = 65408.0f;
+
+// a cheap, well mixed hash for the rounding dither
+inline uint32_t mix(uint32_t a) {
+  a ^= a >> 16;
+  a *= 0x7feb352dU;
+  a ^= a >> 15;
+  a *= 0x846ca68bU;
+  a ^= a >> 16;
+  return a;
+}
+
+// uniform in [0, 1), exact in float
+inline float unit(uint32_t dither) {
+  return (dither >> 8) * (1.0f / 16777216.0f);
+}
+
+// floor(x + u) for x >= 0, without the float add, which rounds and would
+// carry whole x up with u near 1 (1 - u is exact)
+inline uint32_t roundRandomly(float x, float u) {
+  const uint32_t whole = static_cast<uint32_t>(x);
+  return whole + (x - static_cast<float>(whole) >= 1.0f - u);
+}
+
+inline float clampMean(float f, float max) {
+  // also turns NaN into 0
+  return f > 0.0f ? (f < max ? f : max) : 0.0f;
+}
+
+const char *const formatNames[] = { "float", "half", "rgb9e5" };
+
+}
+
+uint16_t halfFromFloat(float f, uint32_t dither) {
+  if (!(f > 0.0f))
+    return 0;
+  uint32_t b;
+  memcpy(&b, &f, sizeof(b));
+  int e = static_cast<int>(b >> 23) - 127;
+  if (e >= 16)
+    return 0x7bff;
+  if (e >= -14) {
+    // random carry into the 10 bits the half keeps, may bump the exponent
+    b += dither >> 19;
+    e = static_cast<int>(b >> 23) - 127;
+    if (e >= 16)
+      return 0x7bff;
+    return static_cast<uint16_t>(((e + 15) << 10) | ((b >> 13) & 0x3ff));
+  }
+  // subnormal halves are multiples of 2^-24, 1024 of them is the smallest
+  // normal one, which happens to have the same encoding
+  return static_cast<uint16_t>(roundRandomly(f * 16777216.0f, unit(dither)));
+}
+
+float floatFromHalf(uint16_t h) {
+  uint32_t e = (h >> 10) & 0x1f;
+  uint32_t m = h & 0x3ff;
+  if (!e)
+    return m * (1.0f / 16777216.0f);
+  uint32_t b = ((e + 112) << 23) | (m << 13);
+  float f;
+  memcpy(&f, &b, sizeof(f));
+  return f;
+}
+
+// 9 bit mantissas with no implicit one and a shared exponent biased by
+// 15, like GL_RGB9_E5: value = mantissa * 2^(exponent - 24)
+uint32_t rgb9e5FromFloats(const float *rgb, uint32_t dither) {
+  float c[3];
+  float maxc = 0.0f;
+  for (int i = 0; i < 3; ++i) {
+    c[i] = clampMean(rgb[i], maxRgb9e5);
+    if (c[i] > maxc) maxc = c[i];
+  }
+  if (maxc <= 0.0f)
+    return 0;
+  int e;
+  frexpf(maxc, &e);
+  // the smallest exponent that fits maxc below 512 steps
+  int exponent = e < -15 ? 0 : e + 15;
+  float u[3];
+  for (int i = 0; i < 3; ++i) {
+    dither = mix(dither + i);
+    u[i] = unit(dither);
+  }
+  uint32_t q[3];
+  for (bool retry = true; retry; ) {
+    retry = false;
+    const float scale = ldexpf(1.0f, 24 - exponent);
+    for (int i = 0; i < 3; ++i) {
+      q[i] = roundRandomly(c[i] * scale, u[i]);
+      if (q[i] > 511) {
+        // rounded up into the next power of two
+        if (exponent < 31) {
+          ++exponent;
+          retry = true;
+          break;
+        }
+        q[i] = 511;
+      }
+    }
+  }
+  return q[0] | (q[1] << 9) | (q[2] << 18) | (static_cast<uint32_t>(exponent) << 27);
+}
+
+void floatsFromRgb9e5(uint32_t v, float *rgb) {
+  const float scale = ldexpf(1.0f, static_cast<int>(v >> 27) - 24);
+  rgb[0] = (v & 0x1ff) * scale;
+  rgb[1] = ((v >> 9) & 0x1ff) * scale;
+  rgb[2] = ((v >> 18) & 0x1ff) * scale;
+}
+
+void tonemap(const float *rgb, uint8_t *pixel) {
+  for (int i = 0; i < 3; ++i) {
+    float c = rgb[i] + 14.0f / 241.0f;
+    pixel[i] = static_cast<int>(c / (c + 1.0f) * 255.0f);
+  }
+  pixel[3] = 255;
+}
+
+Accumulator::Accumulator(int w, int h, AccumulatorFormat format):
+  w(w), h(h), format(format),
+  sums(nullptr), halves(nullptr), shared(nullptr), counts(nullptr), dropped(0) {
+  const size_t pixels = static_cast<size_t>(w) * h;
+  primitives = new uint8_t[pixels]();
+  switch (format) {
+  case ACCUMULATE_FLOAT:
+    sums = new float[pixels * 4]();
+    break;
+  case ACCUMULATE_HALF:
+    halves = new uint16_t[pixels * 4]();
+    break;
+  case ACCUMULATE_RGB9E5:
+    shared = new uint32_t[pixels]();
+    counts = new uint16_t[pixels]();
+    break;
+  }
+}
+
+Accumulator::~Accumulator() {
+  delete[] sums;
+  delete[] halves;
+  delete[] shared;
+  delete[] counts;
+  delete[] primitives;
+}
+
+void Accumulator::clear() {
+  const size_t pixels = static_cast<size_t>(w) * h;
+  switch (format) {
+  case ACCUMULATE_FLOAT:
+    memset(sums, 0, pixels * 4 * sizeof(*sums));
+    break;
+  case ACCUMULATE_HALF:
+    memset(halves, 0, pixels * 4 * sizeof(*halves));
+    break;
+  case ACCUMULATE_RGB9E5:
+    memset(shared, 0, pixels * sizeof(*shared));
+    memset(counts, 0, pixels * sizeof(*counts));
+    break;
+  }
+  memset(primitives, 0, pixels * sizeof(*primitives));
+  dropped = 0;
+}
+
+void Accumulator::clearPixel(size_t index) {
+  switch (format) {
+  case ACCUMULATE_FLOAT:
+    memset(sums + index * 4, 0, 4 * sizeof(*sums));
+    break;
+  case ACCUMULATE_HALF:
+    memset(halves + index * 4, 0, 4 * sizeof(*halves));
+    break;
+  case ACCUMULATE_RGB9E5:
+    shared[index] = 0;
+    counts[index] = 0;
+    break;
+  }
+  primitives[index] = 0;
+}
+
+int Accumulator::invalidate(uint32_t moved) {
+  const size_t pixels = static_cast<size_t>(w) * h;
+  int cleared = 0;
+  for (size_t i = 0; i < pixels; ++i) {
+    // every sample hits something, no bits means no samples
+    if (!primitives[i]) continue;
+    if (primitives[i] & moved) {
+      clearPixel(i);
+      ++cleared;
+    } else {
+      primitives[i] |= moved << 4;
+    }
+  }
+  return cleared;
+}
+
+bool Accumulator::bindToNode(int node) {
+  const size_t pixels = static_cast<size_t>(w) * h;
+  bool bound = false;
+  switch (format) {
+  case ACCUMULATE_FLOAT:
+    bound = ::bindToNode(sums, pixels * 4 * sizeof(*sums), node);
+    break;
+  case ACCUMULATE_HALF:
+    bound = ::bindToNode(halves, pixels * 4 * sizeof(*halves), node);
+    break;
+  case ACCUMULATE_RGB9E5:
+    bound = ::bindToNode(shared, pixels * sizeof(*shared), node) &&
+        ::bindToNode(counts, pixels * sizeof(*counts), node);
+    break;
+  }
+  return bound && ::bindToNode(primitives, pixels * sizeof(*primitives), node);
+}
+
+const void* Accumulator::data() const {
+  switch (format) {
+  case ACCUMULATE_HALF:
+    return halves;
+  case ACCUMULATE_RGB9E5:
+    return shared;
+  default:
+    return sums;
+  }
+}
+
+void Accumulator::add(int x, int y, const float *sum, int numSamples, uint32_t hit,
+    uint8_t *pixel) {
+  const size_t index = static_cast<size_t>(y) * w + x;
+  if (hit & (primitives[index] >> 4)) {
+    // these samples are in only because they hit it, the next ones are
+    // the first fair ones of the new scene
+    clearPixel(index);
+    __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+    return;
+  }
+  primitives[index] |= hit;
+  float mean[3];
+  if (format == ACCUMULATE_FLOAT) {
+    float *s = sums + index * 4;
+    uint32_t &count(*reinterpret_cast<uint32_t*>(s + 3));
+    count += numSamples;
+    const float scale = 1.0f / count;
+    for (int i = 0; i < 3; ++i) {
+      s[i] += sum[i];
+      mean[i] = s[i] * scale;
+    }
+    tonemap(mean, pixel);
+    return;
+  }
+  uint16_t &count(format == ACCUMULATE_HALF ? halves[index * 4 + 3] : counts[index]);
+  const uint32_t total = count + numSamples;
+  const float weight = static_cast<float>(numSamples) / total;
+  const float batchScale = 1.0f / numSamples;
+  uint32_t dither = mix(static_cast<uint32_t>(index) ^ mix(total));
+  this->mean(x, y, mean);
+  for (int i = 0; i < 3; ++i)
+    mean[i] += (sum[i] * batchScale - mean[i]) * weight;
+  if (format == ACCUMULATE_HALF) {
+    uint16_t *p = halves + index * 4;
+    for (int i = 0; i < 3; ++i) {
+      dither = mix(dither + i);
+      p[i] = halfFromFloat(mean[i], dither);
+      mean[i] = floatFromHalf(p[i]);
+    }
+  } else {
+    shared[index] = rgb9e5FromFloats(mean, dither);
+    floatsFromRgb9e5(shared[index], mean);
+  }
+  count = total < maxCount ? total : maxCount;
+  tonemap(mean, pixel);
+}
+
+void Accumulator::mean(int x, int y, float *rgb) const {
+  const size_t index = static_cast<size_t>(y) * w + x;
+  switch (format) {
+  case ACCUMULATE_FLOAT: {
+    const float *s = sums + index * 4;
+    const uint32_t count = *reinterpret_cast<const uint32_t*>(s + 3);
+    const float scale = count ? 1.0f / count : 0.0f;
+    for (int i = 0; i < 3; ++i)
+      rgb[i] = s[i] * scale;
+    break;
+  }
+  case ACCUMULATE_HALF:
+    for (int i = 0; i < 3; ++i)
+      rgb[i] = floatFromHalf(halves[index * 4 + i]);
+    break;
+  case ACCUMULATE_RGB9E5:
+    floatsFromRgb9e5(shared[index], rgb);
+    break;
+  }
+}
+
+int Accumulator::samples(int x, int y) const {
+  const size_t index = static_cast<size_t>(y) * w + x;
+  switch (format) {
+  case ACCUMULATE_FLOAT:
+    return *reinterpret_cast<const uint32_t*>(sums + index * 4 + 3);
+  case ACCUMULATE_HALF:
+    return halves[index * 4 + 3];
+  case ACCUMULATE_RGB9E5:
+    return counts[index];
+  }
+  return 0;
+}
+
+size_t Accumulator::bytesPerPixel(AccumulatorFormat format) {
+  switch (format) {
+  case ACCUMULATE_FLOAT:
+    return 4 * sizeof(float);
+  case ACCUMULATE_HALF:
+    return 4 * sizeof(uint16_t);
+  case ACCUMULATE_RGB9E5:
+    return sizeof(uint32_t) + sizeof(uint16_t);
+  }
+  return 0;
+}
+
+const char* Accumulator::formatName(AccumulatorFormat format) {
+  return formatNames[format];
+}
+
+bool Accumulator::parseFormat(const char *name, AccumulatorFormat &format) {
+  for (int i = 0; i < 3; ++i) {
+    if (!strcmp(name, formatNames[i])) {
+      format = static_cast<AccumulatorFormat>(i);
+      return true;
+    }
+  }
+  return false;
+}
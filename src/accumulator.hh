@@ -0,0 +1,113 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// How the per-pixel sample totals are stored.
+//
+// ACCUMULATE_FLOAT: RGB sums as floats and a uint32_t sample count, 16
+//   bytes per pixel. Exact up to float rounding of the sums, about
+//   samples * 2^-24 relative in the worst case.
+// ACCUMULATE_HALF: RGB running means as half floats and a uint16_t count,
+//   8 bytes per pixel. Each store is within one half ulp (2^-10 relative,
+//   down to 2^-24 absolute near black) of the exact running mean.
+// ACCUMULATE_RGB9E5: RGB running means with 9 bit mantissas and a shared
+//   5 bit exponent, and a uint16_t count, 6 bytes per pixel. Each store is
+//   within 2^-8 of the largest channel (2^-24 absolute near black), so a
+//   dim channel next to a bright one loses relative precision. Means are
+//   clamped to 65408.
+//
+// The compact formats round stochastically, so every store is unbiased,
+// but a running mean carries the rounding of every earlier pass along and
+// the error grows roughly with the square root of the number of passes.
+// Against the float path, after 1024 spp in about 120 passes of 1-16 spp
+// (test/accumulator.cc):
+//   half:   within 1% for means >= 1/64, at most 1 display level off
+//   rgb9e5: within 4% of the brightest channel; with the channels within
+//           4 times of each other, 8% of each and at most 4 display
+//           levels off
+// Past 65535 samples the count stops growing and the mean becomes a
+// moving average over about that many samples.
+//
+// Every format also keeps a byte per pixel of the primitives its samples
+// hit, for redoing only what an edit changed (see invalidate()).
+enum AccumulatorFormat {
+  ACCUMULATE_FLOAT,
+  ACCUMULATE_HALF,
+  ACCUMULATE_RGB9E5,
+};
+
+class Accumulator {
+  const int w, h;
+  const AccumulatorFormat format;
+  // ACCUMULATE_FLOAT: r, g, b sums and the count punned into the 4th float
+  float *sums;
+  // ACCUMULATE_HALF: r, g, b means and the count
+  uint16_t *halves;
+  // ACCUMULATE_RGB9E5: the means and, separately, the counts
+  uint32_t *shared;
+  uint16_t *counts;
+  // per pixel, the primitives its samples hit in the low 4 bits and the
+  // ones that moved since in the high 4, see invalidate()
+  uint8_t *primitives;
+  // pixels add() dropped the samples of, see takeDropped()
+  uint32_t dropped;
+
+  void clearPixel(size_t index);
+public:
+  Accumulator(int w, int h, AccumulatorFormat format);
+  ~Accumulator();
+
+  // forgets all samples
+  void clear();
+
+  // moves the buffers to the NUMA node, see ::bindToNode()
+  bool bindToNode(int node);
+
+  // Adds sum, the total of numSamples new samples, to pixel (x, y) and
+  // writes the tonemapped mean to pixel as RGBA. hit are the bits of the
+  // primitives the samples hit: if one of them moved since the pixel's
+  // older samples were taken, all of them are dropped instead, the new
+  // ones too.
+  void add(int x, int y, const float *sum, int numSamples, uint32_t hit, uint8_t *pixel);
+
+  // Forgets the samples of the pixels that hit any of the primitives
+  // moved, and returns how many. The others may have missed them only
+  // because they weren't in the way yet: add() drops their samples once a
+  // new one hits a moved primitive.
+  int invalidate(uint32_t moved);
+
+  // How many pixels add() dropped the samples of since the last call, for
+  // repairing only where that happened. Safe while rendering.
+  inline uint32_t takeDropped() { return __atomic_exchange_n(&dropped, 0, __ATOMIC_RELAXED); }
+
+  // the current mean of pixel (x, y)
+  void mean(int x, int y, float *rgb) const;
+  int samples(int x, int y) const;
+
+  // The buffer described above, w pixels per row, for readers that want
+  // the samples without a copy. The RGB9E5 counts are in
+  // separateCounts().
+  const void* data() const;
+  inline const uint16_t* separateCounts() const { return counts; }
+
+  inline int getWidth() const { return w; }
+  inline int getHeight() const { return h; }
+  inline AccumulatorFormat getFormat() const { return format; }
+  inline size_t bytes() const { return (bytesPerPixel(format) + sizeof(*primitives)) * w * h; }
+
+  static size_t bytesPerPixel(AccumulatorFormat format);
+  static const char* formatName(AccumulatorFormat format);
+  // false if name isn't one of the formatName()s
+  static bool parseFormat(const char *name, AccumulatorFormat &format);
+};
+
+// The display curve: x / (x + 1) after a small lift of the blacks.
+void tonemap(const float *rgb, uint8_t *pixel);
+
+// Conversions of non-negative floats. dither is a uniform random 32-bit
+// value for stochastic rounding, 0 rounds down.
+uint16_t halfFromFloat(float f, uint32_t dither);
+float floatFromHalf(uint16_t h);
+uint32_t rgb9e5FromFloats(const float *rgb, uint32_t dither);
+void floatsFromRgb9e5(uint32_t v, float *rgb);
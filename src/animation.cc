@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "animation.hh"
+
+namespace {
+
+inline float dot(const float *a, const float *b) {
+  return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+// reprojected points this much nearer or farther (relative) than what the
+// old frame saw there were hidden, or they're on a surface seen edge on
+const float depthTolerance = 0.02f;
+
+}
+
+bool CameraPath::load(const char *path) {
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    fprintf(stderr, "Could not open the camera path %s\n", path);
+    return false;
+  }
+  char line[512];
+  int lineNumber = 0;
+  count = 0;
+  bool ok = true;
+  while (ok && fgets(line, sizeof(line), f)) {
+    ++lineNumber;
+    if (char *comment = strchr(line, '#')) *comment = 0;
+    CameraKey k;
+    char rest;
+    const int n = sscanf(line, "%f %f %f %f %f %f %f %f %f %c", &k.frame,
+        k.camera, k.camera + 1, k.camera + 2, k.forward, k.forward + 1, k.forward + 2,
+        &k.focusDistance, &k.aperture, &rest);
+    if (n == EOF) continue;
+    if (n != 9 || k.focusDistance <= 1.0f || k.aperture <= 0.0f || dot(k.forward, k.forward) <= 0.0f) {
+      fprintf(stderr, "%s:%d: expected frame, camera x y z, forward x y z, focus distance "
+          "(over 1) and aperture\n", path, lineNumber);
+      ok = false;
+    } else if (count && k.frame <= keys[count - 1].frame) {
+      fprintf(stderr, "%s:%d: the frames have to increase\n", path, lineNumber);
+      ok = false;
+    } else if (count == maxKeys) {
+      fprintf(stderr, "%s:%d: more than %d keys\n", path, lineNumber, maxKeys);
+      ok = false;
+    } else {
+      keys[count++] = k;
+    }
+  }
+  fclose(f);
+  if (ok && !count) {
+    fprintf(stderr, "%s has no keys\n", path);
+    ok = false;
+  }
+  return ok;
+}
+
+void CameraPath::at(float frame, CameraKey &key) const {
+  int i = 1;
+  while (i < count && keys[i].frame < frame) ++i;
+  if (i == count || frame <= keys[0].frame) {
+    key = keys[frame <= keys[0].frame ? 0 : count - 1];
+    key.frame = frame;
+    return;
+  }
+  const CameraKey &a(keys[i - 1]), &b(keys[i]);
+  const float t = (frame - a.frame) / (b.frame - a.frame);
+  key.frame = frame;
+  for (int j = 0; j < 3; ++j) {
+    key.camera[j] = a.camera[j] + (b.camera[j] - a.camera[j]) * t;
+    // Renderer::setCamera() normalizes it
+    key.forward[j] = a.forward[j] / sqrtf(dot(a.forward, a.forward)) * (1.0f - t) +
+        b.forward[j] / sqrtf(dot(b.forward, b.forward)) * t;
+  }
+  key.focusDistance = a.focusDistance + (b.focusDistance - a.focusDistance) * t;
+  key.aperture = a.aperture + (b.aperture - a.aperture) * t;
+}
+
+Frame::Frame(int w, int h): w(w), h(h) {
+  means = new float[static_cast<size_t>(w) * h * 3];
+  depths = new float[static_cast<size_t>(w) * h];
+}
+
+Frame::~Frame() {
+  delete[] means;
+  delete[] depths;
+}
+
+void Frame::probe(const Renderer &renderer) {
+  renderer.getCamera(camera, right, up, forward);
+  renderer.probeDepths(depths);
+}
+
+int reproject(const Frame &from, const Frame &to, Renderer &renderer, int numSamples) {
+  const int w = to.w, h = to.h;
+  // right is the aspect ratio long, up and forward 1
+  const float rightLength2 = dot(from.right, from.right);
+  int seeded = 0;
+  for (int y = 0; y < h; ++y) {
+    for (int x = 0; x < w; ++x) {
+      const float depth = to.depths[y * w + x];
+      if (depth < 0.0f) continue;
+      // the point to's pixel center sees, relative to from's camera, the
+      // same way as probeDepths() finds it
+      const float sx = 2.0f * x / w - 1.0f, sy = 1.0f - 2.0f * y / h;
+      float dir[3], p[3];
+      for (int i = 0; i < 3; ++i) {
+        dir[i] = to.right[i] * sx + to.up[i] * sy + to.forward[i];
+      }
+      const float scale = depth / sqrtf(dot(dir, dir));
+      for (int i = 0; i < 3; ++i) {
+        p[i] = to.camera[i] + dir[i] * scale - from.camera[i];
+      }
+      const float ahead = dot(p, from.forward);
+      if (ahead <= 0.0f) continue;
+      const float fx = (dot(p, from.right) / (ahead * rightLength2) + 1.0f) * 0.5f * w;
+      const float fy = (1.0f - dot(p, from.up) / ahead) * 0.5f * h;
+      const int px = static_cast<int>(floorf(fx + 0.5f));
+      const int py = static_cast<int>(floorf(fy + 0.5f));
+      if (px < 0 || px >= w || py < 0 || py >= h) continue;
+      const float seen = from.depths[py * w + px];
+      const float distance = sqrtf(dot(p, p));
+      if (seen < 0.0f || fabsf(seen - distance) > depthTolerance * distance) continue;
+      renderer.seedPixel(x, y, from.means + (py * w + px) * 3, numSamples);
+      ++seeded;
+    }
+  }
+  return seeded;
+}
+
+FrameWriter::FrameWriter(int w, int h, ChannelOrder order):
+  w(w), h(h), red(redChannel(order)), means(nullptr), stopping(false), ok(true),
+  preview(nullptr) {
+  path[0] = 0;
+  rgb = new uint8_t[static_cast<size_t>(w) * h * 3];
+  sem_init(&start, 0, 0);
+  sem_init(&done, 0, 1);
+  pthread_create(&thread, 0, run, this);
+}
+
+FrameWriter::~FrameWriter() {
+  sem_wait(&done);
+  stopping = true;
+  sem_post(&start);
+  pthread_join(thread, nullptr);
+  sem_destroy(&start);
+  sem_destroy(&done);
+  delete[] rgb;
+}
+
+void* FrameWriter::run(void *writerPtr) {
+  FrameWriter *writer = static_cast<FrameWriter*>(writerPtr);
+  while (true) {
+    sem_wait(&writer->start);
+    if (writer->stopping) return nullptr;
+    if (!writer->writeFrame()) writer->ok = false;
+    sem_post(&writer->done);
+  }
+}
+
+bool FrameWriter::writeFrame() {
+  uint8_t *out = rgb;
+  for (int y = h; y--;) {
+    for (int x = w; x--; out += 3) {
+      uint8_t pixel[4];
+      tonemap(means + (static_cast<size_t>(y) * w + x) * 3, pixel);
+      out[0] = pixel[red];
+      out[1] = pixel[1];
+      out[2] = pixel[2 - red];
+    }
+  }
+  if (preview) {
+    for (int y = 0; y < h; ++y) {
+      preview->updateRow(y, rgb + static_cast<size_t>(y) * w * 3);
+    }
+  }
+  FILE *f = fopen(path, "wb");
+  if (!f) return false;
+  fprintf(f, "P6 %d %d 255 ", w, h);
+  bool written = fwrite(rgb, 3, static_cast<size_t>(w) * h, f) == static_cast<size_t>(w) * h;
+  return !fclose(f) && written;
+}
+
+void FrameWriter::write(const float *frameMeans, const char *framePath) {
+  sem_wait(&done);
+  means = frameMeans;
+  snprintf(path, sizeof(path), "%s", framePath);
+  sem_post(&start);
+}
+
+bool FrameWriter::wait() {
+  sem_wait(&done);
+  sem_post(&done);
+  return ok;
+}
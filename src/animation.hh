@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stdint.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "renderer.hh"
+#include "preview.hh"
+
+// Where the camera is at a frame of an animation, what Renderer::setCamera()
+// takes.
+struct CameraKey {
+  float frame;
+  float camera[3], forward[3];
+  float focusDistance, aperture;
+};
+
+// A camera path through keyframes, interpolated linearly in between and
+// held before the first and after the last. The file has a key per line:
+//   frame  camera x y z  forward x y z  focusDistance  aperture
+// with the frames increasing, # starts a comment.
+class CameraPath {
+public:
+  static const int maxKeys = 256;
+private:
+  CameraKey keys[maxKeys];
+  int count;
+public:
+  CameraPath(): count(0) { }
+
+  // false with a message on stderr if the file can't be read or is wrong
+  bool load(const char *path);
+
+  inline int numKeys() const { return count; }
+  inline float lastFrame() const { return count ? keys[count - 1].frame : 0.0f; }
+
+  void at(float frame, CameraKey &key) const;
+};
+
+// What the next frame reuses of a finished one: the camera it was seen
+// from, and the means and first hit depths of its pixels, both row by row
+// in render order like Renderer::copyMeans().
+struct Frame {
+  float camera[4], right[4], up[4], forward[4];
+  float *means;
+  float *depths;
+  int w, h;
+
+  Frame(int w, int h);
+  ~Frame();
+
+  // the renderer's camera and depths, before rendering
+  void probe(const Renderer &renderer);
+};
+
+// Starts the pixels of to's frame, which the renderer has been set up for
+// and has no samples yet, off with numSamples samples of what from saw
+// at the same point: the pixel's center is followed to its first hit and
+// taken back to from's camera. Pixels whose point from didn't see there
+// (it was behind something else or out of the picture) or that see a
+// mirror start empty. Returns how many were seeded.
+int reproject(const Frame &from, const Frame &to, Renderer &renderer, int numSamples);
+
+// Tonemaps and writes frames to PPM files on a thread of its own, so the
+// render threads go on with the next frame meanwhile. The frames look
+// like the front end's output, turned 180 degrees from render order.
+class FrameWriter {
+  pthread_t thread;
+  sem_t start, done;
+  int w, h;
+  // the byte of red in a tonemapped pixel
+  int red;
+  const float *means;
+  char path[1024];
+  bool stopping, ok;
+  uint8_t *rgb;
+  PreviewServer *preview;
+
+  static void* run(void *writerPtr);
+  bool writeFrame();
+public:
+  FrameWriter(int w, int h, ChannelOrder order);
+  ~FrameWriter();
+
+  // Waits for the previous frame to be written, then starts writing the
+  // w x h means (see Frame) to path. They are read until the next write()
+  // or wait() returns.
+  void write(const float *means, const char *path);
+
+  // also hands the frames to preview once they're tonemapped, before the
+  // first write()
+  inline void setPreview(PreviewServer *server) {
+    preview = server;
+  }
+
+  // waits for the last frame, false if any of them couldn't be written
+  bool wait();
+};
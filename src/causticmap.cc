@@ -0,0 +1,129 @@
+#include <math.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "causticmap.hh"
+#include "spatialhash.hh"
+#include "clock.hh"
+
+namespace {
+
+// the largest power of two of entries that fits, at least 4096
+uint32_t tableSize(size_t memoryBytes, size_t entryBytes) {
+  uint32_t size = 4096;
+  while (size < (1U << 28) && 2 * size * entryBytes <= memoryBytes) size <<= 1;
+  return size;
+}
+
+// the cosine between n and the axis cellKey() files it under
+inline float axisCosine(const float *n) {
+  const float ax = fabsf(n[0]), ay = fabsf(n[1]), az = fabsf(n[2]);
+  return ax >= ay && ax >= az ? ax : ay >= az ? ay : az;
+}
+
+inline void atomicAdd(float *f, float v) {
+  uint32_t *bits = reinterpret_cast<uint32_t*>(f);
+  uint32_t old = __atomic_load_n(bits, __ATOMIC_RELAXED), sum;
+  do {
+    float s;
+    memcpy(&s, &old, sizeof(s));
+    s += v;
+    memcpy(&sum, &s, sizeof(sum));
+  } while (!__atomic_compare_exchange_n(bits, &old, sum, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+struct Tracer {
+  pthread_t thread;
+  TracePhotonsFn trace;
+  const View *view;
+  int64_t seed;
+  int count, emitted;
+};
+
+void* runTracer(void *tracerPtr) {
+  Tracer *t = static_cast<Tracer*>(tracerPtr);
+  t->trace(*t->view, &t->seed, t->count, t->emitted);
+  return nullptr;
+}
+
+}
+
+CausticMap::CausticMap(int photons, float cellSize, size_t memoryBytes):
+  mask(tableSize(memoryBytes, sizeof(Entry)) - 1),
+  cellSize(cellSize), invCellSize(1.0f / cellSize),
+  numPhotons(photons), dropped(0), seconds(0.0) {
+  entries = new Entry[numEntries()];
+  clear();
+}
+
+CausticMap::~CausticMap() {
+  delete[] entries;
+}
+
+void CausticMap::clear() {
+  memset(entries, 0, bytes());
+  dropped = 0;
+}
+
+void CausticMap::build(TracePhotonsFn trace, const View &view, int numThreads) {
+  const double start = now();
+  clear();
+  if (numThreads > maxThreads) numThreads = maxThreads;
+  if (numThreads < 1) numThreads = 1;
+  Tracer tracers[maxThreads];
+  for (int i = 0; i < numThreads; ++i) {
+    Tracer &t(tracers[i]);
+    t.trace = trace;
+    t.view = &view;
+    // the same photons every build, only the scene changes them
+    t.seed = 0x5eed + 7919 * i;
+    t.count = numPhotons / numThreads + (i < numPhotons % numThreads);
+    t.emitted = numPhotons;
+    pthread_create(&t.thread, 0, runTracer, &t);
+  }
+  for (int i = 0; i < numThreads; ++i) {
+    pthread_join(tracers[i].thread, nullptr);
+  }
+  seconds = now() - start;
+}
+
+void CausticMap::deposit(const float *p, const float *n, const float *flux) {
+  Entry *e = findEntry(entries, mask, cellKey(p, n, invCellSize, 0, 0), true);
+  if (!e) {
+    __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+    return;
+  }
+  // the surface covers 1 / cos of the cell's face
+  const float c = axisCosine(n);
+  for (int i = 0; i < 3; ++i) {
+    atomicAdd(&e->flux[i], flux[i] * c);
+  }
+  __atomic_fetch_add(&e->photons, 1, __ATOMIC_RELAXED);
+}
+
+bool CausticMap::irradiance(const float *p, const float *n, const float *u, float *rgb) const {
+  // only along the surface, like IrradianceCache::lookup()
+  float j[3], q[3];
+  for (int i = 0; i < 3; ++i) {
+    j[i] = (u[i] - 0.5f) * cellSize;
+  }
+  const float d = j[0] * n[0] + j[1] * n[1] + j[2] * n[2];
+  for (int i = 0; i < 3; ++i) {
+    q[i] = p[i] + j[i] - d * n[i];
+  }
+  const Entry *e = findEntry(entries, mask, cellKey(q, n, invCellSize, 0, 0), false);
+  if (!e) return false;
+  const float scale = invCellSize * invCellSize;
+  for (int i = 0; i < 3; ++i) {
+    rgb[i] = e->flux[i] * scale;
+  }
+  return true;
+}
+
+int CausticMap::usedEntries() const {
+  int used = 0;
+  for (int i = 0; i < numEntries(); ++i) {
+    if (entries[i].key) ++used;
+  }
+  return used;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "kernels.hh"
+
+// The light that reaches the diffuse surfaces over a single mirror bounce
+// (the gold sphere's caustics), from photons traced from the light before
+// rendering. Camera paths find it only when a diffuse bounce happens to
+// hit the mirror and the mirror happens to reflect it into the small
+// light, so it stays noisy for a long time; with a CausticMap the path
+// engine looks it up at every diffuse hit instead and ignores the light
+// its paths reach that way, see tracePath().
+//
+// The photons' flux is summed per cell of a hash grid (and dominant
+// normal axis) like the IrradianceCache's, weighted by how much of the
+// cell's area their surface covers, so a cell's sum over its area is the
+// irradiance. Lookups are jittered along the surface by up to half a cell,
+// which blends the cells into noise instead of blocks: the estimate is a
+// density estimate with a kernel of two cells. The noise of the photons
+// is in the map for good and shared by the pixels that see a cell, the
+// samples don't average it out, more photons do.
+class CausticMap {
+  struct Entry {
+    // the cell and normal axis, 0 for an empty entry
+    uint64_t key;
+    // r, g, b flux
+    float flux[3];
+    uint32_t photons;
+  };
+  Entry *entries;
+  const uint32_t mask;
+  const float cellSize, invCellSize;
+  const int numPhotons;
+  // photons that found the table full, and the time the last build took
+  int dropped;
+  double seconds;
+public:
+  static const int maxThreads = 64;
+
+  // photons traced per build, into a table of at most memoryBytes
+  CausticMap(int photons, float cellSize, size_t memoryBytes);
+  ~CausticMap();
+
+  void clear();
+
+  // Clears the map and traces its photons with numThreads threads. view's
+  // caustics has to be this map, its materials in the render order.
+  void build(TracePhotonsFn trace, const View &view, int numThreads);
+
+  // adds a photon's flux, arriving at p on a surface with normal n
+  void deposit(const float *p, const float *n, const float *flux);
+
+  // The irradiance at the diffuse surface point p with normal n, to be
+  // multiplied by its albedo / pi. u is 3 uniform numbers in [0, 1) for
+  // the jitter. False if no photon landed there.
+  bool irradiance(const float *p, const float *n, const float *u, float *rgb) const;
+
+  int usedEntries() const;
+  inline int numEntries() const { return static_cast<int>(mask) + 1; }
+  inline int getPhotons() const { return numPhotons; }
+  inline int droppedPhotons() const { return dropped; }
+  inline double buildSeconds() const { return seconds; }
+  inline float getCellSize() const { return cellSize; }
+  inline size_t bytes() const { return sizeof(Entry) * numEntries(); }
+};
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <time.h>
+
+// Monotonic wall clock in seconds, for timing passes and ETA estimates.
+inline double now() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
@@ -5,31 +5,49 @@
 #include <stdint.h>
 #include <semaphore.h>
 #include <pthread.h>
+#include <string.h>
 #include <iostream>
 #ifdef __linux__
 #include <unistd.h>
 #endif
 
-#include "sdlcompat.hh"
 #include "platform.hh"
-
-const float TAU = 6.283185307179586f;
+#include "clock.hh"
+#include "scheduler.hh"
+#include "topology.hh"
+#include "counters.hh"
+#include "trace.hh"
+#include "perfcounters.hh"
+#include "kernels.hh"
+#include "accumulator.hh"
+#include "tiledimage.hh"
+#include "renderer.hh"
+#include "animation.hh"
+#include "preview.hh"
 
 #ifdef MIYOO
 #define FLIP_SCREEN
 #endif
 
-struct Random {
-    int64_t seed;
+#ifdef USE_FBDEV
+#include "fbdev.hh"
+#else
+#include "sdlcompat.hh"
+#endif
 
-    int64_t rand() {
-        return seed = (seed * 0x5DEECE66DLL + 0xBLL) & ((1LL << 48) - 1);
+// The rendered pixels are in the renderer's byte order, B, G, R, A or R,
+// G, B, A, image files want R, G, B. w pixels pixelStride bytes apart,
+// red at byte r.
+void rgbFromRow(const uint8_t *row, int pixelStride, int w, int r, uint8_t *rgb) {
+    const int b = 2 - r;
+    for (int i = 0; i < w; ++i, row += pixelStride, rgb += 3) {
+        rgb[0] = row[r];
+        rgb[1] = row[1];
+        rgb[2] = row[b];
     }
+}
 
-    float randomVal() {
-        return (rand() & ((1 << 24) - 1)) / (float) (1 << 24);
-    }
-};
+#ifndef USE_FBDEV
 
 inline uint32_t ablend(uint32_t col, uint8_t alpha) {
 	uint64_t v = 
@@ -41,192 +59,33 @@ inline uint32_t ablend(uint32_t col, uint8_t alpha) {
 		((v >> 8) & 0xff);
 }
 
-float min(float a, float b) { return a < b ? a : b; }
-
-float boxTest(const Vec &pos, const Vec &mins, const Vec &maxs) {
-    Vec d1(pos - mins);
-    Vec d2(maxs - pos);
-    float f[4];
-    d1.min(d2).flatten(f);
-    return min(min(f[0], f[1]), f[2]);
-}
-
-float columnTest(const Vec &pos, const Vec &bottomCenter, float r, float height) {
-    float ymin = bottomCenter.y();
-    float ymax = ymin + height;
-    float p[4];
-    pos.flatten(p);
-    float d1(p[1] - ymin);
-    d1 = -min(d1, ymax - p[1]);
-    Vec v = Vec(p[0], bottomCenter.y(), p[2]) - bottomCenter;
-    float d2 = sqrtf(v | v) - r;
-    if (d2 > d1)
-        return d2;
-    return d1;
-}
-
-enum HitType {
-    HIT_WHITE,
-    HIT_RED,
-    HIT_GREEN,
-    HIT_GOLD,
-    HIT_LIGHT,
-};
-
-const float rc = 0.8660254f, rs = -0.5f;
-const Vec mx(rc, 0.0f, rs);
-const Vec mz(-rs, 0.0f, rc);
-
-float scene(const Vec &pos, int &type) {
-    type = HIT_WHITE;
-    // room and (rotated) box
-    float minDist = min(boxTest(pos, Vec(-10, -10, -10), Vec(10, 10, 10)),
-	        -boxTest(mx * pos.x() + Vec(0.0f, pos.y()) + mz * pos.z(), Vec(3, 6, -3), Vec(7, 10, 1)));
-    // doorway
-    minDist = -min(-minDist,
-        -boxTest(pos, Vec(-3.5, -3, -12.5), Vec(3.5, 10, -9)));
-    // other room
-    minDist = -min(-minDist, -boxTest(pos, Vec(-10, -10, -22), Vec(10, 10, -12)));
-    // column
-//    minDist = min(minDist, columnTest(pos, Vec(0, -10, 0), 1.0f, 3.0f));
-    float sphereDist = (pos - Vec(-6, 7, 5)).length() - 3.0f;
-    if (sphereDist < minDist) minDist = sphereDist, type = HIT_GOLD;
-    float p[4];
-    pos.flatten(p);
-    if (type == HIT_WHITE && p[2] < 10.0f) {
-		if (p[0] < -9.9f)
-		    type = HIT_RED;   // red wall
-		if (p[0] > 9.9f)
-		    type = HIT_GREEN;   // green wall
-		if (p[1] < -9.9f) {
-            if (fabsf(p[0]) <= 5.0f && fabs(p[2]) <= 5.0f)
-                type = HIT_LIGHT;
-			// Vec v(fabsf(p[0]), fabsf(p[2]));
-			// float d = v | v;
-			// if (d < 25.0f && d > 16.0f) { 
-			//     type = HIT_LIGHT;
-			// }
-		}
-    }
-    return minDist;
-}
-
-int march(const Vec &pos, const Vec &dir, Vec &hitPos, Vec &hitNorm) {
-    int type = 0;
-    int noHitCount = 0;
-    float d;
-    for (float traveled = 0.0f; traveled < 100.0f; traveled += d) {
-        if ((d = scene(hitPos = pos + dir * traveled, type)) < 0.01f || ++noHitCount > 99) {
-            // noHitCount is not used anymore, and we don't care about the result
-            hitNorm = Vec(
-                scene(hitPos + Vec(0.01f, 0.0f, 0.0f), noHitCount) - d,
-                scene(hitPos + Vec(0.0f, 0.01f, 0.0f), noHitCount) - d,
-                scene(hitPos + Vec(0.0f, 0.0f, 0.01f), noHitCount) - d
-            );
-            hitNorm.normalize();
-            return type;
-        }
-    }
-    return 0;
-}
-
-Vec tracePath(Random &r, Vec origin, Vec direction, int bounceCount = 3) {
-    Vec sampledPosition, normal, color, attenuation = 1;
-    bool goldBounceAdded = false;
-    while (bounceCount--) {
-        int hitType = march(origin, direction, sampledPosition, normal);
-        if (hitType == HIT_WHITE || hitType == HIT_GREEN || hitType == HIT_RED) {
-            float n[4];
-            normal.flatten(n);
-            float p = TAU * r.randomVal();
-            float c = r.randomVal();
-            float s = sqrtf(1 - c);
-            float g = n[2] < 0 ? -1 : 1;
-            float u = -1 / (g + n[2]);
-            float v = n[0] * n[1] * u;
-            direction = Vec(v,
-                            g + n[1] * n[1] * u,
-                            -n[1]) * (cosf(p) * s)
-                        +
-                        Vec(1 + g * n[0] * n[0] * u,
-                            g * v,
-                            -g * n[0]) * (sinf(p) * s) + normal * sqrtf(c);
-            origin = sampledPosition + direction * 0.1f;
-            direction.normalize();
-            if (hitType == HIT_WHITE)
-                attenuation = attenuation * 0.3f;//0.2;
-            else if (hitType == HIT_RED)
-#ifdef RED_BLUE_SWAP
-                attenuation = attenuation * Vec(0.2f, 0.01f, 0.01f);
-#else
-                attenuation = attenuation * Vec(0.01f, 0.01f, 0.2f);
-#endif
-            else if (hitType == HIT_GREEN)
-                attenuation = attenuation * Vec(0.01f, 0.2f, 0.01f);
-        }
-        if (hitType == HIT_GOLD) {
-            if (!goldBounceAdded) {
-                goldBounceAdded = true;
-                ++bounceCount;
-            }
-            direction = direction - normal * (2.0f * (direction | normal));
-            direction.normalize();
-            origin = sampledPosition + direction * 0.1f;
-            direction = direction + Vec(r.randomVal()*0.2f-0.1f, r.randomVal()*0.2f-0.1f, r.randomVal()*0.2f-0.1f);
-            direction.normalize();
-            const float base = 0.8f;
-#ifdef RED_BLUE_SWAP
-            attenuation = attenuation * Vec(0.98f*base, 0.72f*base, 0.16f*base);
-#else
-            attenuation = attenuation * Vec(0.16f*base, 0.72f*base, 0.98f*base);
-#endif
-        }
-        if (hitType == HIT_LIGHT) {
-#ifdef RED_BLUE_SWAP
-            color = color + attenuation * Vec(50, 80, 100);
-#else
-            color = color + attenuation * Vec(100, 80, 50);
-#endif
-            break;
-        }
-    }
-    return color;
-}
-
-class Renderer;
-
-struct ThreadLocals {
-    pthread_t thread;
-    sem_t restart;
-    sem_t ready;
-    Random random;
-    Renderer *renderer;
-    int samplesCount;
-    bool sync;
-
-    void* renderThread();
-};
-
-void* renderThread(void *localsPtr) {
-    return static_cast<ThreadLocals*>(localsPtr)->renderThread();
-}
-
-
-class Visualizer {
+class Visualizer : public RowSink {
   int w, h;
   Video *video;
   VideoSurface *screen;
+  // what the renderer draws on if it can't draw on the screen itself,
+  // blitted on it by present(), else null
   VideoSurface *rendered;
   VideoSurface *overlay;
   VideoSurface *lastText;
   SDL_Joystick *joystick;
   TTF_Font *font;
   const char *diagnosticLine;
+  // the pixels the renderer draws on, locked from the first row after a
+  // present() to the next
+  LockedSurface target;
+  bool targetLocked;
+
+  // the surface the renderer draws on, for drawing on it between rows
+  inline VideoSurface* canvas() {
+    return rendered ? rendered : screen;
+  }
 public:
   Visualizer(int w, int h):
     w(w), h(h),
     diagnosticLine(nullptr),
-    lastText(nullptr) {
+    lastText(nullptr),
+    targetLocked(false) {
     SDL_Init(SDL_INIT_VIDEO | SDL_INIT_JOYSTICK);
     SDL_JoystickEventState(SDL_ENABLE);
     joystick = SDL_JoystickOpen(0);
@@ -237,7 +96,7 @@ public:
     video = new Video(w, h);
 #endif
     screen = video->getScreen();
-    rendered = video->createSurface(w, h);
+    rendered = video->canLockScreen() ? nullptr : video->createSurface(w, h);
     TTF_Init();
     font = TTF_OpenFont("assets/RobotoMono-Regular.ttf", 25);
   }
@@ -268,6 +127,11 @@ public:
     return h;
   }
 
+  // the screen's byte order
+  inline ChannelOrder channelOrder() const {
+    return video->redFirst() ? CHANNELS_RGB : CHANNELS_BGR;
+  }
+
   void setDiagnosticLine(const char *str) {
     diagnosticLine = str;
     if (lastText) {
@@ -276,38 +140,54 @@ public:
     }
   }
 
-  void drawRow(int y, uint8_t *row) {
-    LockedSurface r;
-    if (!rendered->lock(&r)) {
+  inline int targetRow(int y) const {
 #ifdef FLIP_SCREEN
-      int targetY = y;
+    return y;
 #else
-      int targetY = (h - y - 1);
+    return h - y - 1;
 #endif
-      uint8_t *target = r.pixels + targetY * w*4;
-      uint8_t *source = row;
-#ifdef FLIP_SCREEN
-      target += w * 4;
-#endif          
-      for (int i = 0; i < w; ++i) {
+  }
+
+  // The rows go straight to the screen (or to rendered where that doesn't
+  // work): with FLIP_SCREEN in render order, else turned 180 degrees.
+  uint8_t* rowTarget(int y, int &pixelStride) override {
+    if (!targetLocked) {
+      if (rendered ? rendered->lock(&target) : video->lockScreen(&target)) return nullptr;
+      targetLocked = true;
+    }
+    uint8_t *line = target.pixels + targetRow(y) * target.pitch;
 #ifdef FLIP_SCREEN
-        target -= 4;
-#endif          
-        target[0] = source[0];
-        target[1] = source[1];
-        target[2] = source[2];
-        target[3] = source[3];
-#ifndef FLIP_SCREEN
-        target += 4;
+    pixelStride = 4;
+    return line;
+#else
+    pixelStride = -4;
+    return line + (w - 1) * 4;
 #endif
-        source += 4;
-      }
-      rendered->unlock();
+  }
+
+  // step > 1 means only every step-th pixel of the row is valid (see
+  // Renderer::renderRow), each of them is stretched over a step x step block
+  // so a sparse pass still fills the whole frame
+  void drawRow(int y, uint8_t *pixels, int pixelStride, int step) override {
+    TRACE_SCOPE("draw row");
+    PERF_PHASE(PHASE_DISPLAY);
+    if (!targetLocked || step <= 1) return;
+    stretchRow(pixels, pixelStride, w, step);
+    uint8_t *line = target.pixels + targetRow(y) * target.pitch;
+    for (int dy = 1; dy < step && y + dy < h; ++dy) {
+      memcpy(target.pixels + targetRow(y + dy) * target.pitch, line, w*4);
     }
   }
 
-  void present() {
-    rendered->blitOn(screen, 0, 0);
+  void present() override {
+    TRACE_SCOPE("present");
+    PERF_PHASE(PHASE_DISPLAY);
+    if (rendered) {
+      if (targetLocked) rendered->unlock();
+      rendered->blitOn(screen, 0, 0);
+    }
+    // the screen is unlocked by Video::present()
+    targetLocked = false;
     if (diagnosticLine) {
       if (!lastText) {
         SDL_Color col = { 255, 255, 255 };
@@ -351,13 +231,16 @@ public:
 #endif
         lastText->unlock();
       }
+    }
+    if (diagnosticLine && lastText) {
 #ifdef FLIP_SCREEN
-      lastText->blitOn(screen, screen->getWidth() - lastText->getWidth(), screen->getHeight() - lastText->getHeight());
+      video->present(lastText, screen->getWidth() - lastText->getWidth(), screen->getHeight() - lastText->getHeight());
 #else
-      lastText->blitOn(screen, 0, 0);
+      video->present(lastText, 0, 0);
 #endif
+    } else {
+      video->present();
     }
-    video->present();
   }
 
   bool promptLongPress(const char *q) {
@@ -415,169 +298,24 @@ public:
 #else
         bool grayOnRight = !result;
 #endif
-        rendered->fill(grayOnRight ? rendered->getWidth() >> 1 : 0, 0,
-            rendered->getWidth() >> 1, rendered->getHeight(), 0xff404040U);
-        rendered->fill(
-          !grayOnRight ? rendered->getWidth() >> 1 : 0,
+        canvas()->fill(grayOnRight ? canvas()->getWidth() >> 1 : 0, 0,
+            canvas()->getWidth() >> 1, canvas()->getHeight(), 0xff404040U);
+        canvas()->fill(
+          !grayOnRight ? canvas()->getWidth() >> 1 : 0,
           0,
-          rendered->getWidth() >> 1,
-          rendered->getHeight(),
+          canvas()->getWidth() >> 1,
+          canvas()->getHeight(),
           0xff000000U
         );
       }
     }
-    rendered->fill(0xff000000U);
+    canvas()->fill(0xff000000U);
+    setDiagnosticLine(nullptr);
+    present();
     return result;
   }
 };
 
-class Renderer {
-    friend Visualizer;
-    static const int maxNumThreads = 64;
-    friend ThreadLocals;
-    const int w, h, samplesCount;
-    Vec camera, right, up, forward;
-    uint8_t *row;
-    float *samples;
-    int x, y;
-    float focalLength, aperture, focusDistance, imageDistance, ipOffsetMultiplier;
-    int numThreads;
-    Random commonRandom;
-    ThreadLocals threads[maxNumThreads];
-    Visualizer &v;
-
-    void renderPixel(Random &r, int x, int y, int numSamples) {
-        uint8_t *c = row + (w - 1 - x)*4;
-        Vec color = Vec(0.0f);
-        for (int i = numSamples; --i;) {
-            // this is the subpixel we are calculating
-            float dx = r.randomVal() - 0.5f;
-            float dy = r.randomVal() - 0.5f;
-            Vec dir = right * (2.0f * (x + dx) / w - 1) + up * (1.0f - 2.0f * (y + dy) / h) + forward;
-            // dir is now projected on the focal plane
-            Vec focalPoint = camera + dir * focusDistance;
-            Vec ip(r.randomVal(), r.randomVal());
-            ip = ip.sqrt()*ipOffsetMultiplier;
-            float angle = r.randomVal() * TAU;
-            ip = ip * Vec(cosf(angle), sinf(angle));
-            Vec imagePlanePixel = camera + dir + right * ip.x() + up * ip.y();
-            dir = focalPoint - imagePlanePixel;
-            dir.normalize();
-            color = color + tracePath(r, imagePlanePixel, dir);
-        }
-        float *sample = samples + (y * w + x) * 4;
-        Vec s = Vec(sample[0], sample[1], sample[2]);
-        color = s + color;
-        sample[0] = color.x();
-        sample[1] = color.y();
-        sample[2] = color.z();
-        uint32_t &samplesAtPixel(*reinterpret_cast<uint32_t*>(sample+3));
-        samplesAtPixel += numSamples;
-        color = color * (1.0f / samplesAtPixel) + 14.0f / 241.0f;
-        Vec o = color + 1.0f;
-        color = color / o * 255.0f;
-        *c++ = (int) color.x();
-        *c++ = (int) color.y();
-        *c++ = (int) color.z();
-        *c++ = 255;
-    }
-public:
-    Renderer(Visualizer &v, int samplesCount, int numThreads) : v(v),
-        w(v.getWidth()), h(v.getHeight()),
-        samplesCount(samplesCount),
-        numThreads(numThreads),
-        camera(0.0f, 0.0f, -10.8f),
-        right((float) w / h, 0.0f),
-        up(0.0f, 1.0f),
-        forward(0.0, 0.0, 1.0),
-        row(new uint8_t[w*4]),
-        samples(new float[w*h*4]),
-        focalLength(36.0f / (2.0f * right.x())),
-        aperture(1.2f),
-        focusDistance(15.8f),
-        imageDistance(1.0f),
-        ipOffsetMultiplier(focalLength / (18.0f * 2.0f) / aperture) {
-        commonRandom.seed = static_cast<int64_t>(clock());
-        for (int i = numThreads; i--; ) {
-            ThreadLocals &t(threads[i]);
-            t.renderer = this;
-            t.samplesCount = samplesCount;
-            t.random.seed = commonRandom.seed;
-            sem_init(&t.ready, 0, 0);
-            sem_init(&t.restart, 0, 0);
-            t.sync = i == 0;
-            if (!t.sync)
-                pthread_create(&t.thread, 0, renderThread, &t);
-        }
-    }
-
-    ~Renderer() {
-        delete[] row;
-        delete[] samples;
-        row = nullptr;
-        samples = nullptr;
-    }
-
-    void dumpParameters() {
-        fprintf(stderr, "Rendering %dx%d (samples: %d)\n", w, h, samplesCount);
-        fprintf(stderr, "Aperture: f/%.2f\n", aperture);
-        fprintf(stderr, "Focal length: %.2f\n", focalLength);
-        fprintf(stderr, "ipOffsetMultiplier: %f\n", ipOffsetMultiplier);
-    }
-
-    uint8_t* renderRow(int y) {
-        this->x = w - 1;
-        this->y = y;
-        ThreadLocals *syncThread = 0;
-        for (int i = numThreads; i--; ) {
-            ThreadLocals &t(threads[i]);
-            if (!t.sync) {
-                sem_post(&t.restart);
-            } else {
-                syncThread = &t;
-            }
-        }
-        if (syncThread) syncThread->renderThread();
-        for (int i = numThreads; i--; ) {
-            ThreadLocals &t(threads[i]);
-            if (!t.sync) sem_wait(&t.ready);
-        }
-        v.drawRow(y, row);
-        return row;
-    }
-
-    inline void present() {
-      v.present();
-    }
-
-    inline int getWidth() {
-        return w;
-    }
-
-    inline int getHeight() {
-        return h;
-    }
-};
-
-void* ThreadLocals::renderThread() {
-    while (true) {
-        if (!sync) {
-            sem_wait(&restart);
-        }
-        while (true) {
-            int x = __sync_fetch_and_sub(&renderer->x, 1);
-            if (x < 0) break;
-            renderer->renderPixel(random, x, renderer->y, samplesCount);
-        }
-        if (sync) {
-            break;
-        } else {
-            sem_post(&ready);
-        }
-    }
-    return nullptr;
-}
-
 bool shouldQuit() {
   static int lastKey;
   static Uint8 lastButton = ~0;
@@ -599,67 +337,780 @@ bool shouldQuit() {
   return false;
 }
 
-int main() {
-  const int samplesOverall = 1024;
-  const int samplesPerPass = 4;
-  const int passes = samplesOverall / samplesPerPass;
-  Visualizer visualizer(640, 480);
+#endif
+
+struct Options {
+  // render sparse 1/64, 1/16 and 1/4 subsets before the first full pass
+  bool progressive;
+  int samplesOverall;
+  // 0: picked by the scheduler for each pass
+  int samplesPerPass;
+  // the scheduler aims for passes of this length
+  double passSeconds;
+  // minimum time between screen updates
+  double displayInterval;
+  // leave the slower core classes of big.LITTLE/hybrid CPUs idle
+  bool performanceCoresOnly;
+  bool pinThreads;
+  // split the work and the samples by NUMA node if there are several
+  bool numa;
+  // render kernel variant, null picks the best this cpu supports
+  const char *kernels;
+  AccumulatorFormat accumulator;
+  // the byte order of the pixels, the screen's unless channelsGiven
+  ChannelOrder channels;
+  bool channelsGiven;
+  // trace a claim's paths as a wavefront instead of one after the other
+  bool wavefront;
+  // 0 without an irradiance cache, else the first hit of a path that uses
+  // it, see IrradianceCache
+  int cacheFrom;
+  float cacheCell;
+  int cacheWarmup;
+  // sample diffuse bounces from a PathGuide, guideFraction of them
+  bool guiding;
+  float guideFraction;
+  float guideCell;
+  // look the caustics up in a CausticMap of causticPhotons photons
+  bool caustics;
+  int causticPhotons;
+  float causticCell;
+  int causticMegabytes;
+  // move moved by moveOffset after moveAfter samples per pixel, if moving
+  bool moving;
+  PrimitiveId moved;
+  float moveOffset[3];
+  int moveAfter;
+  // headless poster mode if posterWidth > 0, see renderPoster()
+  int posterWidth, posterHeight;
+  int tileSize;
+  const char *outputPath;
+  // headless animation mode if cameraPath is set, see renderAnimation()
+  const char *cameraPath;
+  int frames;
+  const char *framePattern;
+  int reuseSamples;
+  // serve a live preview on previewAddress if set, see PreviewServer
+  const char *previewAddress;
+  double previewInterval;
+#ifdef HOT_COUNTERS
+  const char *countersPath;
+#endif
+#ifdef TRACE_EVENTS
+  const char *tracePath;
+#endif
+
+  Options():
+    progressive(true),
+    samplesOverall(1024),
+    samplesPerPass(0),
+    passSeconds(3.0),
+    displayInterval(0.25),
+    performanceCoresOnly(false),
+    pinThreads(true),
+    numa(true),
+    kernels(nullptr),
+    accumulator(ACCUMULATE_FLOAT),
+    channels(defaultChannelOrder),
+    channelsGiven(false),
+    wavefront(false),
+    cacheFrom(0),
+    cacheCell(0.5f),
+    cacheWarmup(64),
+    guiding(false),
+    guideFraction(0.5f),
+    guideCell(2.5f),
+    caustics(false),
+    causticPhotons(1000000),
+    causticCell(0.5f),
+    causticMegabytes(16),
+    moving(false),
+    moved(PRIMITIVE_SPHERE),
+    moveOffset(),
+    moveAfter(0),
+    posterWidth(0),
+    posterHeight(0),
+    tileSize(256),
+    outputPath("poster.cbt"),
+    cameraPath(nullptr),
+    frames(0),
+    framePattern("frame%04d.ppm"),
+    reuseSamples(0),
+    previewAddress(nullptr),
+    previewInterval(1.0)
+#ifdef HOT_COUNTERS
+    , countersPath("counters.json")
+#endif
+#ifdef TRACE_EVENTS
+    , tracePath("trace.json")
+#endif
+    { }
+};
+
+void printUsage(const char *name) {
+  fprintf(stderr, "Usage: %s [options] > image.ppm\n", name);
+  fprintf(stderr, "  --no-progressive   skip the coarse preview passes\n");
+  fprintf(stderr, "  --samples N        samples per pixel overall (1024)\n");
+  fprintf(stderr, "  --spp N            fixed samples per pass instead of adapting\n");
+  fprintf(stderr, "  --pass-seconds S   target duration of a pass (3)\n");
+  fprintf(stderr, "  --display-interval S  minimum time between screen updates (0.25)\n");
+  fprintf(stderr, "  --performance-cores-only  only run on the fastest class of cores\n");
+  fprintf(stderr, "  --no-pin           don't pin the render threads to cpus\n");
+  fprintf(stderr, "  --no-numa          share one image buffer and work queue between NUMA nodes\n");
+  fprintf(stderr, "  --kernels NAME     render kernel variant (auto), \"list\" lists them\n");
+  fprintf(stderr, "  --accumulator F    float (17 bytes/pixel), half (9) or rgb9e5 (7)\n");
+  fprintf(stderr, "  --engine E         path (one path at a time) or wavefront (batches)\n");
+  fprintf(stderr, "  --channels C       pixel byte order, bgr or rgb (the screen's)\n");
+  fprintf(stderr, "  --irradiance-cache H  end paths at cached light from their secondary\n");
+  fprintf(stderr, "                     or (blurrier, faster) primary diffuse hits on\n");
+  fprintf(stderr, "  --cache-cell S     irradiance cache cell size in scene units (0.5)\n");
+  fprintf(stderr, "  --cache-warmup N   samples a cache cell needs before it's used (64)\n");
+  fprintf(stderr, "  --path-guiding     sample diffuse bounces towards where light came from\n");
+  fprintf(stderr, "  --guide-fraction F share of the bounces that follow the guide (0.5)\n");
+  fprintf(stderr, "  --guide-cell S     path guide cell size in scene units (2.5)\n");
+  fprintf(stderr, "  --caustics         trace photons for the gold sphere's caustics first\n");
+  fprintf(stderr, "  --caustic-photons N  photons to trace (1000000)\n");
+  fprintf(stderr, "  --caustic-cell S   caustic map cell size in scene units (0.5)\n");
+  fprintf(stderr, "  --caustic-memory MB  caustic map size limit (16)\n");
+  fprintf(stderr, "  --move P X,Y,Z     move the block or the sphere by X, Y, Z\n");
+  fprintf(stderr, "  --move-after N     ... after N samples per pixel, rendering only the\n");
+  fprintf(stderr, "                     pixels that change again (0: before rendering)\n");
+  fprintf(stderr, "  --poster WxH       render headless in tiles to a tiled image file\n");
+  fprintf(stderr, "  --tile N           poster tile size (256)\n");
+  fprintf(stderr, "  --output PATH      poster file (poster.cbt), see build/cbtstitch\n");
+  fprintf(stderr, "  --animate PATH     render the frames of a camera path headless, see\n");
+  fprintf(stderr, "                     animation.hh, --samples of them each\n");
+  fprintf(stderr, "  --frames N         frames to render (up to the path's last key)\n");
+  fprintf(stderr, "  --frame-output P   frame file names, one %%d (frame%%04d.ppm)\n");
+  fprintf(stderr, "  --reuse N          start each frame with N samples of the last one\n");
+  fprintf(stderr, "  --preview A        serve a live preview on port, host:port or socket path\n");
+  fprintf(stderr, "                     A, see build/cbpreview\n");
+  fprintf(stderr, "  --preview-interval S  minimum time between preview updates (1)\n");
+#ifdef HOT_COUNTERS
+  fprintf(stderr, "  --counters-json PATH  where to write the counters (counters.json)\n");
+#endif
+#ifdef TRACE_EVENTS
+  fprintf(stderr, "  --trace-json PATH  where to write the trace events (trace.json)\n");
+#endif
+}
+
+// a printf format with a single conversion, a %d with an optional width
+bool isFramePattern(const char *pattern) {
+  int conversions = 0;
+  for (const char *c = pattern; *c; ++c) {
+    if (*c != '%') continue;
+    ++c;
+    while (*c >= '0' && *c <= '9') ++c;
+    if (*c != 'd') return false;
+    ++conversions;
+  }
+  return conversions == 1;
+}
+
+bool parseOptions(int argc, char **argv, Options &options) {
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    if (!strcmp(arg, "--no-progressive")) {
+      options.progressive = false;
+    } else if (!strcmp(arg, "--progressive")) {
+      options.progressive = true;
+    } else if (!strcmp(arg, "--performance-cores-only")) {
+      options.performanceCoresOnly = true;
+    } else if (!strcmp(arg, "--no-pin")) {
+      options.pinThreads = false;
+    } else if (!strcmp(arg, "--no-numa")) {
+      options.numa = false;
+    } else if (!strcmp(arg, "--path-guiding")) {
+      options.guiding = true;
+#ifdef HOT_COUNTERS
+    } else if (i + 1 < argc && !strcmp(arg, "--counters-json")) {
+      options.countersPath = argv[++i];
+#endif
+#ifdef TRACE_EVENTS
+    } else if (i + 1 < argc && !strcmp(arg, "--trace-json")) {
+      options.tracePath = argv[++i];
+#endif
+    } else if (i + 1 < argc && !strcmp(arg, "--kernels")) {
+      options.kernels = argv[++i];
+    } else if (i + 1 < argc && !strcmp(arg, "--accumulator")) {
+      if (!Accumulator::parseFormat(argv[++i], options.accumulator)) return false;
+    } else if (i + 1 < argc && !strcmp(arg, "--channels")) {
+      if (!parseChannelOrder(argv[++i], options.channels)) return false;
+      options.channelsGiven = true;
+    } else if (i + 1 < argc && !strcmp(arg, "--engine")) {
+      const char *engine = argv[++i];
+      if (strcmp(engine, "path") && strcmp(engine, "wavefront")) return false;
+      options.wavefront = !strcmp(engine, "wavefront");
+    } else if (i + 1 < argc && !strcmp(arg, "--irradiance-cache")) {
+      const char *hit = argv[++i];
+      if (strcmp(hit, "primary") && strcmp(hit, "secondary")) return false;
+      options.cacheFrom = !strcmp(hit, "primary") ? 1 : 2;
+    } else if (i + 1 < argc && !strcmp(arg, "--cache-cell")) {
+      options.cacheCell = atof(argv[++i]);
+      if (options.cacheCell <= 0.0f) return false;
+    } else if (i + 1 < argc && !strcmp(arg, "--cache-warmup")) {
+      options.cacheWarmup = atoi(argv[++i]);
+      if (options.cacheWarmup <= 0) return false;
+    } else if (i + 1 < argc && !strcmp(arg, "--guide-fraction")) {
+      options.guideFraction = atof(argv[++i]);
+      if (options.guideFraction <= 0.0f || options.guideFraction >= 1.0f) return false;
+    } else if (i + 1 < argc && !strcmp(arg, "--guide-cell")) {
+      options.guideCell = atof(argv[++i]);
+      if (options.guideCell <= 0.0f) return false;
+    } else if (!strcmp(arg, "--caustics")) {
+      options.caustics = true;
+    } else if (i + 1 < argc && !strcmp(arg, "--caustic-photons")) {
+      options.causticPhotons = atoi(argv[++i]);
+      if (options.causticPhotons <= 0) return false;
+    } else if (i + 1 < argc && !strcmp(arg, "--caustic-cell")) {
+      options.causticCell = atof(argv[++i]);
+      if (options.causticCell <= 0.0f) return false;
+    } else if (i + 1 < argc && !strcmp(arg, "--caustic-memory")) {
+      options.causticMegabytes = atoi(argv[++i]);
+      if (options.causticMegabytes <= 0) return false;
+    } else if (i + 2 < argc && !strcmp(arg, "--move")) {
+      if (!parsePrimitive(argv[++i], options.moved) || options.moved == PRIMITIVE_ROOMS) return false;
+      float *o = options.moveOffset;
+      if (sscanf(argv[++i], "%f,%f,%f", o, o + 1, o + 2) != 3) return false;
+      options.moving = true;
+    } else if (i + 1 < argc && !strcmp(arg, "--move-after")) {
+      options.moveAfter = atoi(argv[++i]);
+      if (options.moveAfter < 0) return false;
+    } else if (i + 1 < argc && !strcmp(arg, "--poster")) {
+      if (sscanf(argv[++i], "%dx%d", &options.posterWidth, &options.posterHeight) != 2 ||
+          options.posterWidth <= 0 || options.posterHeight <= 0) return false;
+    } else if (i + 1 < argc && !strcmp(arg, "--tile")) {
+      options.tileSize = atoi(argv[++i]);
+      if (options.tileSize <= 0) return false;
+    } else if (i + 1 < argc && !strcmp(arg, "--output")) {
+      options.outputPath = argv[++i];
+    } else if (i + 1 < argc && !strcmp(arg, "--animate")) {
+      options.cameraPath = argv[++i];
+    } else if (i + 1 < argc && !strcmp(arg, "--frames")) {
+      options.frames = atoi(argv[++i]);
+      if (options.frames <= 0) return false;
+    } else if (i + 1 < argc && !strcmp(arg, "--frame-output")) {
+      options.framePattern = argv[++i];
+      if (!isFramePattern(options.framePattern)) return false;
+    } else if (i + 1 < argc && !strcmp(arg, "--reuse")) {
+      options.reuseSamples = atoi(argv[++i]);
+      if (options.reuseSamples < 0) return false;
+    } else if (i + 1 < argc && !strcmp(arg, "--preview")) {
+      options.previewAddress = argv[++i];
+    } else if (i + 1 < argc && !strcmp(arg, "--preview-interval")) {
+      options.previewInterval = atof(argv[++i]);
+      if (options.previewInterval <= 0.0) return false;
+    } else if (i + 1 < argc && !strcmp(arg, "--samples")) {
+      options.samplesOverall = atoi(argv[++i]);
+      if (options.samplesOverall <= 0) return false;
+    } else if (i + 1 < argc && !strcmp(arg, "--spp")) {
+      options.samplesPerPass = atoi(argv[++i]);
+      if (options.samplesPerPass <= 0) return false;
+    } else if (i + 1 < argc && !strcmp(arg, "--pass-seconds")) {
+      options.passSeconds = atof(argv[++i]);
+      if (options.passSeconds <= 0.0) return false;
+    } else if (i + 1 < argc && !strcmp(arg, "--display-interval")) {
+      options.displayInterval = atof(argv[++i]);
+      if (options.displayInterval < 0.0) return false;
+    } else {
+      fprintf(stderr, "Unknown option: %s\n", arg);
+      return false;
+    }
+  }
+  if (options.cacheFrom && options.wavefront) {
+    fprintf(stderr, "The irradiance cache only works with the path engine\n");
+    return false;
+  }
+  if (options.guiding && options.wavefront) {
+    fprintf(stderr, "Path guiding only works with the path engine\n");
+    return false;
+  }
+  if (options.caustics && options.wavefront) {
+    fprintf(stderr, "The caustic map only works with the path engine\n");
+    return false;
+  }
+  if (options.previewAddress && options.posterWidth > 0 && !options.cameraPath) {
+    fprintf(stderr, "There is no preview of posters, they needn't fit in memory\n");
+    return false;
+  }
+  return true;
+}
+
+// Hands row y, just rendered, to preview if there is one, in screen
+// order like the output, rgb has room for it. A sparse row goes over the
+// step - 1 rows it was stretched over on screen too.
+void previewRow(PreviewServer *preview, const Renderer &renderer, int y, int step, uint8_t *rgb) {
+  if (!preview) return;
+  const int w = renderer.getWidth(), h = renderer.getHeight();
+  rgbFromRow(renderer.rowPixel(w - 1), -renderer.getPixelStride(), w,
+      redChannel(renderer.getChannelOrder()), rgb);
+  for (int dy = 0; dy < step && y + dy < h; ++dy) {
+    preview->updateRow(h - 1 - y - dy, rgb);
+  }
+}
+
+// Renders the image at 1/8, 1/4 and 1/2 resolution (1/64, 1/16 and 1/4 of
+// the pixels), each level stretched over the whole frame, so there is a
+// recognizable picture long before the first full pass is done.
+// The sparse pixels keep their samples, later passes just add to them.
+bool renderPreview(Renderer &renderer, Visualizer &visualizer, PassScheduler &scheduler,
+    PreviewServer *preview, uint8_t *rgb) {
+  static const int steps[] = { 8, 4, 2 };
+  static char info[64];
+  for (int step : steps) {
+    TRACE_SCOPE("preview level");
+    snprintf(info, sizeof(info), "preview 1/%d", step * step);
+    visualizer.setDiagnosticLine(info);
+    int rows = 0;
+    const int pixels = (renderer.getWidth() + step - 1) / step;
+    for (int y = (renderer.getHeight() - 1) / step * step; y >= 0; y -= step) {
+      double rowStart = now();
+      renderer.renderRow(y, step);
+      scheduler.record(static_cast<int64_t>(pixels) * renderer.getSamplesPerPass(), now() - rowStart);
+      previewRow(preview, renderer, y, step, rgb);
+      if (++rows % 16 == 0) renderer.present();
+      if (shouldQuit()) return false;
+    }
+    renderer.present();
+  }
+  return true;
+}
+
+// Renders the pixels an edit took the samples of back up to target, and
+// only them: the rest of the frame keeps what it has. False if the user
+// quit.
+bool repair(Renderer &renderer, Visualizer &visualizer, int target,
+    PreviewServer *preview, uint8_t *rgb) {
+  TRACE_SCOPE("repair");
+  static char info[64];
+  const double start = now();
+  const int behind = renderer.pixelsBehind(target);
+  snprintf(info, sizeof(info), "repairing %d pixels", behind);
+  visualizer.setDiagnosticLine(info);
+  for (int y = renderer.getHeight(); y--;) {
+    renderer.repairRow(y, target);
+    previewRow(preview, renderer, y, 1, rgb);
+    if (y % 16 == 0) renderer.present();
+    if (shouldQuit()) return false;
+  }
+  fprintf(stderr, "Repaired %d pixels to %d samples in %.2fs\n", behind, target, now() - start);
+  return true;
+}
+
+// Picks the cpus of the render threads and their expected relative
+// speeds, returns the number of threads. If there is a visualizer the user
+// can choose a single core instead.
+int selectThreads(const Options &options, CpuTopology &topology, Visualizer *visualizer,
+    int *cpus, float *speeds) {
   int numThreads = 2;
-  int numCpus = -1;
 #ifdef __linux__
-  numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+  topology.dump(stderr);
+  int numCpus = topology.select(cpus, Renderer::maxNumThreads, options.performanceCoresOnly);
   if (numCpus > 0) numThreads = numCpus;
-  if (visualizer.promptLongPress(" A+B: single core     just A: multicore ")) {
+  if (visualizer && visualizer->promptLongPress(" A+B: single core     just A: multicore ")) {
     numThreads = 1;
   }
 #endif
-  Renderer renderer(visualizer, samplesPerPass, numThreads);
+  for (int i = 0; i < numThreads; ++i) {
+    speeds[i] = i < topology.count() ? topology.relativeSpeed(cpus[i]) : 1.0f;
+  }
+  return numThreads;
+}
+
+// The NUMA nodes of the render threads, null if they aren't pinned or
+// there is only one node.
+const int* selectNodes(const Options &options, const CpuTopology &topology,
+    const int *cpus, int numThreads, int *nodes) {
+  if (!options.numa || !cpus || topology.nodes() < 2) return nullptr;
+  for (int i = 0; i < numThreads; ++i) {
+    nodes[i] = topology.nodeOf(cpus[i]);
+  }
+  return nodes;
+}
+
+// the irradiance cache of the options, null if there is none
+IrradianceCache* createCache(const Options &options) {
+  if (!options.cacheFrom) return nullptr;
+  return new IrradianceCache(sceneSurfaceArea, options.cacheCell, options.cacheWarmup);
+}
+
+// the path guide of the options, null if there is none
+PathGuide* createGuide(const Options &options) {
+  if (!options.guiding) return nullptr;
+  return new PathGuide(sceneSurfaceArea, options.guideCell);
+}
+
+// the caustic map of the options, null if there is none
+CausticMap* createCausticMap(const Options &options) {
+  if (!options.caustics) return nullptr;
+  return new CausticMap(options.causticPhotons, options.causticCell,
+      static_cast<size_t>(options.causticMegabytes) << 20);
+}
+
+// the preview server of the options, null if there is none or it couldn't
+// start
+PreviewServer* startPreview(const Options &options, int w, int h) {
+  if (!options.previewAddress) return nullptr;
+  PreviewServer *preview = new PreviewServer(w, h, options.previewInterval);
+  if (!preview->start(options.previewAddress)) {
+    delete preview;
+    return nullptr;
+  }
+  fprintf(stderr, "Preview on %s\n", options.previewAddress);
+  return preview;
+}
+
+void stopPreview(PreviewServer *preview) {
+  if (!preview) return;
+  preview->stop();
+  const uint64_t raw = preview->getRawTileBytes();
+  fprintf(stderr, "Preview: %d viewers, %.1f KB sent, the changed tiles coded to %.0f%%\n",
+      preview->getViewersServed(), preview->getBytesSent() / 1024.0,
+      raw ? preview->getBytesSent() * 100.0 / raw : 0.0);
+  delete preview;
+}
+
+// The guide learns from every row, rows this far apart sample from what
+// it learned. An update takes about a millisecond.
+const int guideUpdateRows = 32;
+
+void dumpStats(Renderer &renderer, const Options &options) {
+  // only the counter and trace builds write files named in options
+  (void) options;
+  renderer.dumpThreadStats();
+  if (const IrradianceCache *cache = renderer.getIrradianceCache()) {
+    fprintf(stderr, "Irradiance cache: %d of %d entries used\n",
+        cache->usedEntries(), cache->numEntries());
+  }
+  if (const PathGuide *guide = renderer.getPathGuide()) {
+    fprintf(stderr, "Path guide: %d of %d entries used, %d trained\n",
+        guide->usedEntries(), guide->numEntries(), guide->trainedEntries());
+  }
+#ifdef HOT_COUNTERS
+  dumpHotCounters(stderr, renderer.getNumThreads());
+  if (writeHotCountersJson(options.countersPath, renderer.getNumThreads()))
+    fprintf(stderr, "Counters written to %s\n", options.countersPath);
+#endif
+#ifdef PERF_COUNTERS
+  dumpPerfCounters(stderr);
+#endif
+#ifdef TRACE_EVENTS
+  if (writeTrace(options.tracePath))
+    fprintf(stderr, "Trace written to %s\n", options.tracePath);
+#endif
+}
+
+// Renders a poster sized frame one tile at a time, each to full spp, and
+// streams the finished tiles into a tiled image file. Only one tile's
+// samples are in memory at any time, so the frame can be much bigger than
+// RAM. The output is the frame as it would be on screen.
+int renderPoster(const Options &options, const RenderKernels *kernels,
+    int numThreads, const int *cpus, const float *speeds, const int *nodes) {
+  const int w = options.posterWidth;
+  const int h = options.posterHeight;
+  const int spp = options.samplesOverall;
+  TiledImage image;
+  if (!image.create(options.outputPath, w, h, options.tileSize)) {
+    fprintf(stderr, "Could not create %s\n", options.outputPath);
+    return 1;
+  }
+  Renderer renderer(nullptr, w, h, options.tileSize, kernels, options.accumulator,
+      spp, numThreads, cpus, speeds, nodes);
+  renderer.setWavefront(options.wavefront);
+  renderer.setChannelOrder(options.channels);
+  IrradianceCache *cache = createCache(options);
+  renderer.setIrradianceCache(cache, options.cacheFrom);
+  PathGuide *guide = createGuide(options);
+  renderer.setPathGuide(guide, options.guideFraction);
+  if (options.moving) renderer.movePrimitive(options.moved, options.moveOffset);
+  CausticMap *caustics = createCausticMap(options);
+  renderer.setCausticMap(caustics);
   renderer.dumpParameters();
-  printf("P6 %d %d 255 ", renderer.getWidth(), renderer.getHeight());
-  int last = time(NULL);
-  int start = last;
-  const int passedHeight = renderer.getHeight() * passes;
-  bool quit = false;
-  char info[1024];
-  int linesLeft = 1;
-  for (int pass = passes; pass--;) {
-    int passBase = renderer.getHeight() * (passes - pass - 1);
-    for (int y=renderer.getHeight(); y--;) {
-      --linesLeft;
-      bool present = linesLeft <= 0 || y == 0;
-      if (present) {
-        linesLeft = 64;
-        int current = time(NULL);
-        int overall = current - start;
-
-        int progress = passBase + (renderer.getHeight() - y);
-        int remaining = passedHeight - progress;
-        int left = (float) overall * remaining / progress;
-        int expected = (float) overall * passedHeight / progress;
-        if (left <= 0) {
-          left = 0;
-          expected = overall;
-        }
+  uint8_t *rgb = new uint8_t[options.tileSize * options.tileSize * 3];
+  const int tiles = image.tilesX() * image.tilesY();
+  const double start = now();
+  int64_t pixelsDone = 0;
+  bool ok = true;
+  for (uint32_t ty = 0; ok && ty < image.tilesY(); ++ty) {
+    for (uint32_t tx = 0; ok && tx < image.tilesX(); ++tx) {
+      TRACE_SCOPE("tile");
+      const int tw = image.tileWidth(tx);
+      const int th = image.tileHeight(ty);
+      // on screen the frame is turned 180 degrees, so is each tile
+      renderer.setWindow(w - tx * options.tileSize - tw, h - ty * options.tileSize - th, tw, th);
+      renderer.setClaimSize(PassScheduler::claimSize(spp, numThreads, tw,
+          renderer.getSamplesPerClaim()));
+      for (int y = 0; y < th; ++y) {
+        renderer.renderRow(y);
+        if (guide && y % guideUpdateRows == guideUpdateRows - 1) guide->update();
+      }
+      rgbFromRow(renderer.getImage(), 4, tw * th, redChannel(renderer.getChannelOrder()), rgb);
+      {
+        TRACE_SCOPE("output");
+        ok = image.writeTile(tx, ty, rgb);
+      }
+      pixelsDone += static_cast<int64_t>(tw) * th;
+      const double elapsed = now() - start;
+      const double done = static_cast<double>(pixelsDone) / (static_cast<double>(w) * h);
+      const int left = static_cast<int>(elapsed / done - elapsed + 0.5);
+      fprintf(stderr, "\rtile %d/%d %6.2f%% %3d:%02d:%02d left %.0f samples/s ",
+          ty * image.tilesX() + tx + 1, tiles, done * 100.0,
+          left / 3600, left / 60 % 60, left % 60, pixelsDone * spp / elapsed);
+    }
+  }
+  fprintf(stderr, "\n");
+  delete[] rgb;
+  if (!ok) {
+    delete cache;
+    delete guide;
+    delete caustics;
+    fprintf(stderr, "Could not write %s\n", options.outputPath);
+    return 1;
+  }
+  dumpStats(renderer, options);
+  delete cache;
+  delete guide;
+  delete caustics;
+  fprintf(stderr, "Poster written to %s\n", options.outputPath);
+  return 0;
+}
+
+// Renders the frames of the camera path headless, each to
+// options.samplesOverall new samples per pixel in a single pass, into
+// numbered PPM files. A frame is tonemapped and written while the next
+// one renders. With reuseSamples each frame starts with that many samples
+// of the last one where it sees the same surfaces, see reproject(). The
+// irradiance cache and the path guide don't depend on the camera and go
+// on learning from frame to frame.
+int renderAnimation(const Options &options, const RenderKernels *kernels,
+    int numThreads, const int *cpus, const float *speeds, const int *nodes) {
+  CameraPath path;
+  if (!path.load(options.cameraPath)) return 1;
+  const int numFrames = options.frames ? options.frames : static_cast<int>(path.lastFrame()) + 1;
+  const int w = 640, h = 480;
+  const int spp = options.samplesOverall;
+  Renderer renderer(nullptr, w, h, 0, kernels, options.accumulator,
+      spp, numThreads, cpus, speeds, nodes);
+  renderer.setWavefront(options.wavefront);
+  renderer.setChannelOrder(options.channels);
+  renderer.setClaimSize(PassScheduler::claimSize(spp, numThreads, w, renderer.getSamplesPerClaim()));
+  IrradianceCache *cache = createCache(options);
+  renderer.setIrradianceCache(cache, options.cacheFrom);
+  PathGuide *guide = createGuide(options);
+  renderer.setPathGuide(guide, options.guideFraction);
+  if (options.moving) renderer.movePrimitive(options.moved, options.moveOffset);
+  CausticMap *caustics = createCausticMap(options);
+  renderer.setCausticMap(caustics);
+  renderer.dumpParameters();
+  fprintf(stderr, "Animation: %d frames, %d keys, %d samples reused\n",
+      numFrames, path.numKeys(), options.reuseSamples);
+  // the frame being rendered and the last one, which is being written
+  Frame *frames[2] = { new Frame(w, h), new Frame(w, h) };
+  FrameWriter writer(w, h, renderer.getChannelOrder());
+  PreviewServer *preview = startPreview(options, w, h);
+  if (options.previewAddress && !preview) {
+    delete frames[0];
+    delete frames[1];
+    delete cache;
+    delete guide;
+    delete caustics;
+    return 1;
+  }
+  writer.setPreview(preview);
+  char name[1024];
+  const double start = now();
+  int64_t seededOverall = 0;
+  for (int f = 0; f < numFrames; ++f) {
+    TRACE_SCOPE("frame");
+    Frame &frame(*frames[f & 1]);
+    CameraKey key;
+    path.at(f, key);
+    renderer.setCamera(key.camera, key.forward, key.focusDistance, key.aperture);
+    renderer.setWindow(0, 0, w, h);
+    int seeded = 0;
+    if (options.reuseSamples) {
+      TRACE_SCOPE("reproject");
+      frame.probe(renderer);
+      if (f) seeded = reproject(*frames[~f & 1], frame, renderer, options.reuseSamples);
+      seededOverall += seeded;
+    }
+    for (int y = h; y--;) {
+      renderer.renderRow(y);
+      if (guide && y % guideUpdateRows == 0) guide->update();
+    }
+    renderer.copyMeans(frame.means);
+    snprintf(name, sizeof(name), options.framePattern, f);
+    writer.write(frame.means, name);
+    const double elapsed = now() - start;
+    const int left = static_cast<int>(elapsed / (f + 1) * (numFrames - f - 1) + 0.5);
+    fprintf(stderr, "\rframe %d/%d %5.1f%% reused %3d:%02d:%02d left %.2fs per frame ",
+        f + 1, numFrames, seeded * 100.0 / (static_cast<double>(w) * h),
+        left / 3600, left / 60 % 60, left % 60, elapsed / (f + 1));
+  }
+  const bool ok = writer.wait();
+  const double elapsed = now() - start;
+  fprintf(stderr, "\n%d frames in %.1fs, %.1f frames per hour, %.1f%% of the pixels reused\n",
+      numFrames, elapsed, numFrames * 3600.0 / elapsed,
+      numFrames > 1 ? seededOverall * 100.0 / (static_cast<double>(w) * h * (numFrames - 1)) : 0.0);
+  stopPreview(preview);
+  delete frames[0];
+  delete frames[1];
+  if (!ok) {
+    delete cache;
+    delete guide;
+    delete caustics;
+    fprintf(stderr, "Could not write the frames to %s\n", options.framePattern);
+    return 1;
+  }
+  dumpStats(renderer, options);
+  delete cache;
+  delete guide;
+  delete caustics;
+  return 0;
+}
 
-        snprintf(info, sizeof(info), "%6.2f%% %3d:%02d:%02d %3d:%02d:%02d %3d:%02d:%02d (%d)",
-                progress*100.0f/passedHeight,
+int main(int argc, char **argv) {
+  Options options;
+  if (!parseOptions(argc, argv, options)) {
+    printUsage(argv[0]);
+    return 1;
+  }
+  if (options.kernels && !strcmp(options.kernels, "list")) {
+    listKernels(stdout);
+    return 0;
+  }
+  const RenderKernels *kernels = selectKernels(options.kernels);
+  if (!kernels) {
+    fprintf(stderr, "Render kernels %s are not available, the options are:\n", options.kernels);
+    listKernels(stderr);
+    return 1;
+  }
+  int cpus[Renderer::maxNumThreads];
+  float speeds[Renderer::maxNumThreads];
+  int nodes[Renderer::maxNumThreads];
+  CpuTopology topology;
+  if (options.cameraPath) {
+    int numThreads = selectThreads(options, topology, nullptr, cpus, speeds);
+    const int *pinned = options.pinThreads && numThreads <= topology.count() ? cpus : nullptr;
+    return renderAnimation(options, kernels, numThreads, pinned, speeds,
+        selectNodes(options, topology, pinned, numThreads, nodes));
+  }
+  if (options.posterWidth > 0) {
+    int numThreads = selectThreads(options, topology, nullptr, cpus, speeds);
+    const int *pinned = options.pinThreads && numThreads <= topology.count() ? cpus : nullptr;
+    return renderPoster(options, kernels, numThreads, pinned, speeds,
+        selectNodes(options, topology, pinned, numThreads, nodes));
+  }
+  Visualizer visualizer(640, 480);
+  int numThreads = selectThreads(options, topology, &visualizer, cpus, speeds);
+  const int *pinned = options.pinThreads && numThreads <= topology.count() ? cpus : nullptr;
+  const int w = visualizer.getWidth();
+  const int h = visualizer.getHeight();
+  PassScheduler scheduler(static_cast<int64_t>(w) * h, options.samplesOverall, options.passSeconds);
+  scheduler.setFixedSamplesPerPass(options.samplesPerPass);
+  Renderer renderer(&visualizer, w, h, 0, kernels, options.accumulator,
+      scheduler.nextPassSamples(), numThreads, pinned, speeds,
+      selectNodes(options, topology, pinned, numThreads, nodes));
+  renderer.setWavefront(options.wavefront);
+  renderer.setChannelOrder(options.channelsGiven ? options.channels : visualizer.channelOrder());
+  IrradianceCache *cache = createCache(options);
+  renderer.setIrradianceCache(cache, options.cacheFrom);
+  PathGuide *guide = createGuide(options);
+  renderer.setPathGuide(guide, options.guideFraction);
+  bool movePending = options.moving;
+  if (movePending && !options.moveAfter) {
+    renderer.movePrimitive(options.moved, options.moveOffset);
+    movePending = false;
+  }
+  CausticMap *caustics = createCausticMap(options);
+  renderer.setCausticMap(caustics);
+  renderer.dumpParameters();
+  PreviewServer *preview = startPreview(options, w, h);
+  if (options.previewAddress && !preview) {
+    delete cache;
+    delete guide;
+    delete caustics;
+    return 1;
+  }
+  printf("P6 %d %d 255 ", w, h);
+  uint8_t *rgb = new uint8_t[w * 3];
+  bool quit = options.progressive && !renderPreview(renderer, visualizer, scheduler, preview, rgb);
+  char info[1024];
+  const double start = now();
+  double lastPresent = -options.displayInterval;
+  while (!quit && !scheduler.done()) {
+    if (movePending && scheduler.getSamplesDone() >= options.moveAfter) {
+      const int cleared = renderer.movePrimitive(options.moved, options.moveOffset);
+      fprintf(stderr, "\nMoved the %s, %d pixels hit it\n", primitiveName(options.moved), cleared);
+      movePending = false;
+      quit = !repair(renderer, visualizer, scheduler.getSamplesDone(), preview, rgb);
+      if (quit) break;
+    }
+    const int samplesPerPass = scheduler.nextPassSamples();
+    const bool lastPass = scheduler.getSamplesDone() + samplesPerPass >= scheduler.getSamplesOverall();
+    renderer.setSamplesPerPass(samplesPerPass);
+    renderer.setClaimSize(PassScheduler::claimSize(samplesPerPass, numThreads, w,
+        renderer.getSamplesPerClaim()));
+    int64_t samplesInPass = 0;
+    TRACE_SCOPE("pass");
+    for (int y = h; y--;) {
+      double rowStart = now();
+      renderer.renderRow(y);
+      // the pixels whose new samples were the first to hit what moved, left
+      // out of what the scheduler plans passes by
+      double repairSeconds = 0.0;
+      if (renderer.takeDroppedPixels()) {
+        const double repairStart = now();
+        renderer.repairRow(y, scheduler.getSamplesDone() + samplesPerPass);
+        repairSeconds = now() - repairStart;
+      }
+      if (guide && y % guideUpdateRows == 0) guide->update();
+      previewRow(preview, renderer, y, 1, rgb);
+      if (lastPass && !preview) {
+        // as on the screen, pixel w - 1 first, and before present() unlocks
+        // the screen it is on (previewRow() did that already)
+        rgbFromRow(renderer.rowPixel(w - 1), -renderer.getPixelStride(), w,
+            redChannel(renderer.getChannelOrder()), rgb);
+      }
+      double current = now();
+      samplesInPass += static_cast<int64_t>(w) * samplesPerPass;
+      scheduler.record(static_cast<int64_t>(w) * samplesPerPass, current - rowStart - repairSeconds);
+      if (current - lastPresent >= options.displayInterval || y == 0) {
+        int overall = static_cast<int>(current - start);
+        int left = static_cast<int>(scheduler.remainingSeconds(current - start, samplesInPass) + 0.5);
+        int expected = overall + left;
+        snprintf(info, sizeof(info), "%6.2f%% %3d:%02d:%02d %3d:%02d:%02d %3d:%02d:%02d (%d) %dspp",
+                scheduler.progress(samplesInPass) * 100.0,
                 overall / 3600, overall / 60 % 60, overall % 60,
                 left / 3600, left / 60 % 60, left % 60,
-                expected / 3600, expected / 60 % 60, expected % 60, numThreads);
-        fprintf(stderr, "\r%s %d %d (%d)", info, progress, passedHeight, passBase);
-        last = current;
+                expected / 3600, expected / 60 % 60, expected % 60, numThreads, samplesPerPass);
+        fprintf(stderr, "\r%s %.0f samples/s ", info, scheduler.samplesPerSecond());
+#ifdef HOT_COUNTERS
+        size_t length = strlen(info);
+        info[length++] = ' ';
+        formatHotCounters(info + length, sizeof(info) - length, mergedHotCounters(numThreads));
+#endif
         visualizer.setDiagnosticLine(info);
+        renderer.present();
+        lastPresent = now();
+      }
+      if (lastPass) {
+        TRACE_SCOPE("output");
+        fwrite(rgb, 3, w, stdout);
       }
-      uint8_t *c = renderer.renderRow(y);
-      if (present) renderer.present();
-      if (!pass)
-        fwrite(c, renderer.getWidth(), 3, stdout);
       quit = shouldQuit();
       if (quit) break;
     }
-    if (quit) break;
+    if (!quit) scheduler.finishPass(samplesPerPass);
   }
   fprintf(stderr, "\n");
+  delete[] rgb;
+  dumpStats(renderer, options);
+  fflush(stdout);
   while (!shouldQuit());
+  stopPreview(preview);
+  delete cache;
+  delete guide;
+  delete caustics;
   return 0;
 }
@@ -0,0 +1,136 @@
+#ifndef CORNELLBOX_H
+#define CORNELLBOX_H
+
+/*
+ * libcornellbox: the path tracer without the SDL front end, for embedding.
+ * Link build/libcornellbox.a or build/libcornellbox.so (make lib) and
+ * -lpthread -lm -lstdc++.
+ *
+ * A renderer renders passes of samples_per_pass samples per pixel over the
+ * whole frame and keeps the sums. The tonemapped image and the samples
+ * are read straight from the renderer's buffers, nothing is copied: the
+ * pointers stay valid until cb_destroy(). They are updated in place while
+ * a render runs, so read them between renders or from the pass callback
+ * to see whole passes.
+ */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct cb_renderer cb_renderer;
+
+/* how the samples are kept, see accumulator.hh for the precision */
+typedef enum cb_accumulator_format {
+  /* r, g, b sums as floats, then the sample count as a uint32_t */
+  CB_ACCUMULATE_FLOAT,
+  /* r, g, b means as half floats, then the count as a uint16_t */
+  CB_ACCUMULATE_HALF,
+  /* r, g, b means as GL_RGB9_E5 in a uint32_t, counts separately */
+  CB_ACCUMULATE_RGB9E5
+} cb_accumulator_format;
+
+/* the parts of the scene that can be moved, the room can't */
+typedef enum cb_primitive {
+  CB_PRIMITIVE_BLOCK = 1,
+  CB_PRIMITIVE_SPHERE
+} cb_primitive;
+
+typedef struct cb_settings {
+  /* the defaults are in brackets */
+  /* frame size (640 x 480) */
+  int width, height;
+  /* samples per pixel of each pass (4) */
+  int samples_per_pass;
+  /* render threads, 0 for one per cpu (0) */
+  int threads;
+  /* pin the threads to cpus, fastest first (1) */
+  int pin_threads;
+  /* split the work and samples by NUMA node if there are several (1) */
+  int numa;
+  /* leave the slower core classes of hybrid cpus idle (0) */
+  int performance_cores_only;
+  /* trace batches of paths as a wavefront (0) */
+  int wavefront;
+  /* how the samples are kept (CB_ACCUMULATE_FLOAT) */
+  cb_accumulator_format accumulator;
+  /* render kernel variant, NULL for the best one (NULL) */
+  const char *kernels;
+  /* image bytes R, G, B, A instead of B, G, R, A (0, 1 if built with
+     RED_BLUE_SWAP) */
+  int red_first;
+} cb_settings;
+
+/* width * height tonemapped pixels of 4 bytes, red at byte red_channel,
+   green at 1, blue at 2 - red_channel and 255 at 3. The first row is the
+   top of the picture. */
+typedef struct cb_image {
+  const uint8_t *pixels;
+  int width, height;
+  /* bytes per row */
+  int stride;
+  int red_channel;
+} cb_image;
+
+/* The samples of a W x H frame, one slice of columns per NUMA node. They
+   are in render order, the picture turned by 180 degrees: pixel (i, j) of
+   a slice is pixel (W - 1 - x - i, H - 1 - j) of the image. The channels
+   are in the image's order. */
+typedef struct cb_slice {
+  /* pixels in the format's layout */
+  const void *data;
+  /* CB_ACCUMULATE_RGB9E5 only: the uint16_t sample counts, same layout */
+  const uint16_t *counts;
+  cb_accumulator_format format;
+  /* the slice's first column in render order, and its number of columns */
+  int x, columns;
+  /* pixels per row of data and counts, H rows */
+  int stride;
+} cb_slice;
+
+/* called on the render thread after each pass, nonzero stops the render;
+   passes_done counts all of the renderer's passes so far */
+typedef int (*cb_pass_callback)(cb_renderer *renderer, int passes_done, void *user);
+
+void cb_default_settings(cb_settings *settings);
+
+/* starts the render threads, NULL if the settings are invalid or the
+   kernels aren't supported by this cpu */
+cb_renderer *cb_create(const cb_settings *settings);
+/* stops a running render first */
+void cb_destroy(cb_renderer *renderer);
+
+/* renders passes passes, returns how many it did or -1 if a render is
+   already running */
+int cb_render(cb_renderer *renderer, int passes);
+/* the same on a thread of its own, returns 0 if it started */
+int cb_render_async(cb_renderer *renderer, int passes,
+    cb_pass_callback callback, void *user);
+/* makes the running render stop after the current row */
+void cb_cancel(cb_renderer *renderer);
+/* waits for cb_render_async() to end, returns its passes */
+int cb_wait(cb_renderer *renderer);
+
+/* Moves primitive to x, y, z from where the scene has it (0, 0, 0 puts it
+   back) and throws away the samples of the pixels that saw it, directly or
+   through a bounce. Returns how many pixels those were, or -1 if a render
+   is running or primitive is not a cb_primitive. The following renders
+   first bring those pixels back to cb_samples(), and so does
+   cb_render(renderer, 0) on its own. */
+int cb_move_primitive(cb_renderer *renderer, cb_primitive primitive,
+    float x, float y, float z);
+
+/* samples per pixel of the finished passes */
+int cb_samples(const cb_renderer *renderer);
+
+void cb_get_image(const cb_renderer *renderer, cb_image *image);
+int cb_slice_count(const cb_renderer *renderer);
+void cb_get_slice(const cb_renderer *renderer, int index, cb_slice *slice);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,135 @@
+#ifdef HOT_COUNTERS
+
+#include <string.h>
+
+#include "counters.hh"
+
+namespace {
+  // one cache line (at least) per thread, no false sharing while counting
+  HotCounters slots[HotCounters::maxThreads];
+  // threads that never attached count here instead of crashing
+  HotCounters unattached;
+}
+
+thread_local HotCounters *hotCounters = &unattached;
+
+void HotCounters::add(const HotCounters &o) {
+  sceneCalls += o.sceneCalls;
+  marchCalls += o.marchCalls;
+  marchSteps += o.marchSteps;
+  marchStepCap += o.marchStepCap;
+  marchEscapes += o.marchEscapes;
+  paths += o.paths;
+  lightHits += o.lightHits;
+  cacheHits += o.cacheHits;
+  cacheRecords += o.cacheRecords;
+  guidedBounces += o.guidedBounces;
+  for (int i = 0; i <= maxPathLength; ++i) pathLength[i] += o.pathLength[i];
+  pixels += o.pixels;
+  samples += o.samples;
+}
+
+void attachHotCounters(int thread) {
+  hotCounters = thread >= 0 && thread < HotCounters::maxThreads ? &slots[thread] : &unattached;
+}
+
+HotCounters mergedHotCounters(int numThreads) {
+  HotCounters total;
+  memset(&total, 0, sizeof(total));
+  for (int i = 0; i < numThreads && i < HotCounters::maxThreads; ++i) total.add(slots[i]);
+  total.add(unattached);
+  return total;
+}
+
+namespace {
+  inline double ratio(uint64_t a, uint64_t b) {
+    return b ? static_cast<double>(a) / b : 0.0;
+  }
+}
+
+void formatHotCounters(char *buf, size_t size, const HotCounters &c) {
+  snprintf(buf, size, "%.1f scn/ray %.1f ray/path %.2f%% cap",
+      ratio(c.sceneCalls, c.marchCalls), ratio(c.marchCalls, c.paths),
+      100.0 * ratio(c.marchStepCap, c.marchCalls));
+}
+
+void dumpHotCounters(FILE *f, int numThreads) {
+  HotCounters c = mergedHotCounters(numThreads);
+  fprintf(f, "Hot counters:\n");
+  fprintf(f, "  paths:         %14llu (%.2f per sample)\n",
+      (unsigned long long) c.paths, ratio(c.paths, c.samples));
+  fprintf(f, "  rays:          %14llu (%.2f per path)\n",
+      (unsigned long long) c.marchCalls, ratio(c.marchCalls, c.paths));
+  fprintf(f, "  scene calls:   %14llu (%.2f per ray)\n",
+      (unsigned long long) c.sceneCalls, ratio(c.sceneCalls, c.marchCalls));
+  fprintf(f, "  march steps:   %14llu (%.2f per ray)\n",
+      (unsigned long long) c.marchSteps, ratio(c.marchSteps, c.marchCalls));
+  fprintf(f, "  step cap hits: %14llu (%.3f%% of rays)\n",
+      (unsigned long long) c.marchStepCap, 100.0 * ratio(c.marchStepCap, c.marchCalls));
+  fprintf(f, "  escapes:       %14llu (%.3f%% of rays)\n",
+      (unsigned long long) c.marchEscapes, 100.0 * ratio(c.marchEscapes, c.marchCalls));
+  fprintf(f, "  light hits:    %14llu (%.2f%% of paths)\n",
+      (unsigned long long) c.lightHits, 100.0 * ratio(c.lightHits, c.paths));
+  if (c.cacheHits || c.cacheRecords) {
+    fprintf(f, "  cache hits:    %14llu (%.2f%% of paths)\n",
+        (unsigned long long) c.cacheHits, 100.0 * ratio(c.cacheHits, c.paths));
+    fprintf(f, "  cache records: %14llu (%.2f per path)\n",
+        (unsigned long long) c.cacheRecords, ratio(c.cacheRecords, c.paths));
+  }
+  if (c.guidedBounces) {
+    fprintf(f, "  guided:        %14llu (%.2f per path)\n",
+        (unsigned long long) c.guidedBounces, ratio(c.guidedBounces, c.paths));
+  }
+  for (int i = 1; i <= HotCounters::maxPathLength; ++i) {
+    if (!c.pathLength[i]) continue;
+    fprintf(f, "  path length %d: %14llu (%.2f%%)\n", i,
+        (unsigned long long) c.pathLength[i], 100.0 * ratio(c.pathLength[i], c.paths));
+  }
+  for (int i = 0; i < numThreads && i < HotCounters::maxThreads; ++i) {
+    fprintf(f, "  thread %3d:    %14llu pixels\n", i, (unsigned long long) slots[i].pixels);
+  }
+}
+
+namespace {
+  void writeJsonFields(FILE *f, const HotCounters &c, const char *indent) {
+    fprintf(f, "%s\"sceneCalls\": %llu,\n", indent, (unsigned long long) c.sceneCalls);
+    fprintf(f, "%s\"marchCalls\": %llu,\n", indent, (unsigned long long) c.marchCalls);
+    fprintf(f, "%s\"marchSteps\": %llu,\n", indent, (unsigned long long) c.marchSteps);
+    fprintf(f, "%s\"marchStepCap\": %llu,\n", indent, (unsigned long long) c.marchStepCap);
+    fprintf(f, "%s\"marchEscapes\": %llu,\n", indent, (unsigned long long) c.marchEscapes);
+    fprintf(f, "%s\"paths\": %llu,\n", indent, (unsigned long long) c.paths);
+    fprintf(f, "%s\"lightHits\": %llu,\n", indent, (unsigned long long) c.lightHits);
+    fprintf(f, "%s\"cacheHits\": %llu,\n", indent, (unsigned long long) c.cacheHits);
+    fprintf(f, "%s\"cacheRecords\": %llu,\n", indent, (unsigned long long) c.cacheRecords);
+    fprintf(f, "%s\"guidedBounces\": %llu,\n", indent, (unsigned long long) c.guidedBounces);
+    fprintf(f, "%s\"pathLength\": [", indent);
+    for (int i = 0; i <= HotCounters::maxPathLength; ++i) {
+      fprintf(f, "%s%llu", i ? ", " : "", (unsigned long long) c.pathLength[i]);
+    }
+    fprintf(f, "],\n");
+    fprintf(f, "%s\"pixels\": %llu,\n", indent, (unsigned long long) c.pixels);
+    fprintf(f, "%s\"samples\": %llu\n", indent, (unsigned long long) c.samples);
+  }
+}
+
+bool writeHotCountersJson(const char *path, int numThreads) {
+  FILE *f = fopen(path, "w");
+  if (!f) {
+    perror(path);
+    return false;
+  }
+  HotCounters total = mergedHotCounters(numThreads);
+  fprintf(f, "{\n  \"total\": {\n");
+  writeJsonFields(f, total, "    ");
+  fprintf(f, "  },\n  \"threads\": [\n");
+  for (int i = 0; i < numThreads && i < HotCounters::maxThreads; ++i) {
+    fprintf(f, "    {\n");
+    writeJsonFields(f, slots[i], "      ");
+    fprintf(f, "    }%s\n", i + 1 < numThreads ? "," : "");
+  }
+  fprintf(f, "  ]\n}\n");
+  fclose(f);
+  return true;
+}
+
+#endif
@@ -0,0 +1,57 @@
+#pragma once
+
+// Per-thread event counters for the render kernels, compiled in with
+// -DHOT_COUNTERS. Without it COUNT() expands to nothing, so the kernels
+// are exactly as they were.
+
+#ifdef HOT_COUNTERS
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct alignas(64) HotCounters {
+  static const int maxPathLength = 8;
+  static const int maxThreads = 256;
+
+  uint64_t sceneCalls;
+  uint64_t marchCalls;
+  uint64_t marchSteps;
+  // march() gave up after 99 steps
+  uint64_t marchStepCap;
+  // march() left the scene without a hit
+  uint64_t marchEscapes;
+  uint64_t paths;
+  uint64_t lightHits;
+  // paths ended by the irradiance cache, and vertices recorded into it
+  uint64_t cacheHits;
+  uint64_t cacheRecords;
+  // diffuse bounces that followed the path guide
+  uint64_t guidedBounces;
+  // number of march() calls per path
+  uint64_t pathLength[maxPathLength + 1];
+  uint64_t pixels;
+  uint64_t samples;
+
+  void add(const HotCounters &other);
+};
+
+// the calling thread's slot, set by attachHotCounters
+extern thread_local HotCounters *hotCounters;
+
+void attachHotCounters(int thread);
+HotCounters mergedHotCounters(int numThreads);
+// short summary for the diagnostic line
+void formatHotCounters(char *buf, size_t size, const HotCounters &c);
+void dumpHotCounters(FILE *f, int numThreads);
+bool writeHotCountersJson(const char *path, int numThreads);
+
+#define COUNT(field) (++hotCounters->field)
+#define COUNT_ADD(field, n) (hotCounters->field += (n))
+
+#else
+
+#define COUNT(field) ((void) 0)
+#define COUNT_ADD(field, n) ((void) 0)
+
+#endif
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#if defined(__SSE__)
+#include <x86intrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Cheap replacements for the libm calls of the sampling code. They are
+// plain inline float code without libm calls or branches, so they cost a
+// few multiplies even where libm is slow (the soft-float ABI builds) and
+// the array versions vectorize with the kernel variants' instruction sets.
+//
+// Maximum errors against the exact results, over every float in range:
+//   rsqrt           2^-20 <= x < 2^20
+//                   x86 (rsqrtss and one Newton step): 4 ulp
+//                   NEON (vrsqrte and two steps): 2.2 ulp
+//                   otherwise (bit trick and three steps): 2.2 ulp
+//   sinCosQuarter   |x| <= pi/4: 0.8 ulp for sin, 1.3 ulp for cos
+//   sinCos          |x| <= 8192: 1.6 ulp, or 2^-26 absolute where the
+//                   result is below 1/8 (near the zeros)
+//   concentricDisk  within 2e-7 of the exact mapping
+//   cosineHemisphere
+//                   within 2e-7 of unit length
+// (the NEON figure is from a scalar model of vrsqrte's 8 bit estimate)
+// test/fastmath.cc checks these against double precision libm.
+// rsqrt's x86 estimate comes from a table that differs between CPU
+// vendors, so results aren't bit identical across machines.
+
+// 1 / sqrt(x) for normal x > 0
+inline float rsqrt(float x) {
+#if defined(__SSE__)
+  const float e = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(x)));
+  return e * (1.5f - 0.5f * x * e * e);
+#elif defined(__ARM_NEON)
+  const float32x2_t v = vdup_n_f32(x);
+  float32x2_t e = vrsqrte_f32(v);
+  e = vmul_f32(e, vrsqrts_f32(vmul_f32(v, e), e));
+  e = vmul_f32(e, vrsqrts_f32(vmul_f32(v, e), e));
+  return vget_lane_f32(e, 0);
+#else
+  uint32_t i;
+  memcpy(&i, &x, sizeof(i));
+  i = 0x5f375a86U - (i >> 1);
+  float e;
+  memcpy(&e, &i, sizeof(e));
+  for (int step = 0; step < 3; ++step)
+    e = e * (1.5f - 0.5f * x * e * e);
+  return e;
+#endif
+}
+
+// sin and cos of |x| <= pi/4, minimax polynomials from Cephes
+inline void sinCosQuarter(float x, float &s, float &c) {
+  const float z = x * x;
+  s = x + x * z * (-1.6666654611e-1f + z * (8.3321608736e-3f + z * -1.9515295891e-4f));
+  c = 1.0f - 0.5f * z +
+      z * z * (4.166664568298827e-2f + z * (-1.388731625493765e-3f + z * 2.443315711809948e-5f));
+}
+
+// sin and cos of |x| <= 8192
+inline void sinCos(float x, float &s, float &c) {
+  // the nearest multiple of pi/2, subtracted in three parts so the
+  // remainder stays exact
+  const int q = static_cast<int>(x * 0.63661977f + (x < 0.0f ? -0.5f : 0.5f));
+  const float k = static_cast<float>(q);
+  const float r = ((x - k * 1.5703125f) - k * 4.837512969970703125e-4f) - k * 7.549789948768648e-8f;
+  float rs, rc;
+  sinCosQuarter(r, rs, rc);
+  // rotate by q quarter turns, q & 3 is right for negative q too
+  const float a = q & 1 ? rc : rs;
+  const float b = q & 1 ? rs : rc;
+  s = q & 2 ? -a : a;
+  c = (q + 1) & 2 ? -b : b;
+}
+
+// Shirley and Chiu's concentric mapping of [0, 1)^2 onto the unit disk. It
+// keeps areas and strata, and every angle it needs is within pi/4 of an
+// axis, so it gets by with sinCosQuarter().
+inline void concentricDisk(float u, float v, float &x, float &y) {
+  const float a = 2.0f * u - 1.0f;
+  const float b = 2.0f * v - 1.0f;
+  const bool alongA = fabsf(a) > fabsf(b);
+  const float r = alongA ? a : b;
+  // a and b are both 0 if r is
+  const float d = r != 0.0f ? r : 1.0f;
+  const float t = 0.78539816f * (alongA ? b : a) / d;
+  float s, c;
+  sinCosQuarter(t, s, c);
+  const float rc = r * c, rs = r * s;
+  x = alongA ? rc : rs;
+  y = alongA ? rs : rc;
+}
+
+// A cosine weighted direction around z: a point on the disk lifted onto
+// the hemisphere (Malley's method).
+inline void cosineHemisphere(float u, float v, float &x, float &y, float &z) {
+  concentricDisk(u, v, x, y);
+  const float h = 1.0f - x * x - y * y;
+  z = sqrtf(h > 0.0f ? h : 0.0f);
+}
+
+// n of the above at once, for the wavefront engine
+inline void sinCos(const float *x, float *s, float *c, int n) {
+  for (int i = 0; i < n; ++i)
+    sinCos(x[i], s[i], c[i]);
+}
+
+inline void cosineHemisphere(const float *u, const float *v, float *x, float *y, float *z, int n) {
+  for (int i = 0; i < n; ++i)
+    cosineHemisphere(u[i], v[i], x[i], y[i], z[i]);
+}
@@ -0,0 +1,184 @@
+#ifdef USE_FBDEV
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/fb.h>
+#include <linux/input.h>
+
+#include "fbdev.hh"
+
+namespace {
+
+const int maxInputs = 32;
+struct pollfd inputs[maxInputs];
+int numInputs = -1;
+
+// every /dev/input/event* that can be read, once
+void openInputs() {
+  if (numInputs >= 0) return;
+  numInputs = 0;
+  for (int i = 0; i < maxInputs; ++i) {
+    char path[32];
+    snprintf(path, sizeof(path), "/dev/input/event%d", i);
+    int fd = open(path, O_RDONLY | O_NONBLOCK);
+    if (fd < 0) continue;
+    inputs[numInputs].fd = fd;
+    inputs[numInputs].events = POLLIN;
+    ++numInputs;
+  }
+  if (!numInputs) fprintf(stderr, "No input devices, /dev/input/event* can't be read\n");
+}
+
+// The next key or button press (value 1) or release (0), waiting up to
+// timeout milliseconds (-1: for ever) if there is none. Repeats are left
+// out.
+bool nextKey(int timeout, int &code, int &value) {
+  openInputs();
+  while (true) {
+    for (int i = 0; i < numInputs; ++i) {
+      struct input_event event;
+      while (read(inputs[i].fd, &event, sizeof(event)) == sizeof(event)) {
+        if (event.type == EV_KEY && event.value != 2) {
+          code = event.code;
+          value = event.value;
+          return true;
+        }
+      }
+    }
+    if (!timeout || !numInputs || poll(inputs, numInputs, timeout) <= 0) return false;
+  }
+}
+
+}
+
+Visualizer::Visualizer(int w, int h): w(w), h(h) {
+  const char *path = getenv("FRAMEBUFFER");
+  if (!path) path = "/dev/fb0";
+  struct fb_var_screeninfo var;
+  struct fb_fix_screeninfo fix;
+  fd = open(path, O_RDWR);
+  if (fd < 0 || ioctl(fd, FBIOGET_VSCREENINFO, &var) || ioctl(fd, FBIOGET_FSCREENINFO, &fix)) {
+    perror("Fatal: could not open the framebuffer");
+    exit(1);
+  }
+  if (var.bits_per_pixel != 32 || var.xres < static_cast<unsigned>(w) ||
+      var.yres < static_cast<unsigned>(h)) {
+    fprintf(stderr, "Fatal: %s is %ux%u at %u bits per pixel, %dx%d at 32 is needed\n",
+        path, var.xres, var.yres, var.bits_per_pixel, w, h);
+    exit(1);
+  }
+  // the renderer writes B, G, R, A or R, G, B, A bytes
+  redFirst = var.red.offset == 0;
+  if (var.red.offset != 0 && var.red.offset != 16) {
+    fprintf(stderr, "%s has red at bit %u, the colors will be off\n", path, var.red.offset);
+  }
+  mapBytes = fix.smem_len;
+  void *mapped = mmap(nullptr, mapBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (mapped == MAP_FAILED) {
+    perror("Fatal: could not map the framebuffer");
+    exit(1);
+  }
+  map = static_cast<uint8_t*>(mapped);
+  pitch = fix.line_length;
+  frame = map + (var.yoffset + (var.yres - h) / 2) * pitch + (var.xoffset + (var.xres - w) / 2) * 4;
+  fill(0, 0, w, h, 0xff000000U);
+}
+
+Visualizer::~Visualizer() {
+  munmap(map, mapBytes);
+  close(fd);
+}
+
+void Visualizer::fill(int x, int y, int width, int height, uint32_t color) {
+  for (int j = y; j < y + height; ++j) {
+    uint32_t *pixel = reinterpret_cast<uint32_t*>(frame + j * pitch) + x;
+    for (int i = 0; i < width; ++i) {
+      pixel[i] = color;
+    }
+  }
+}
+
+// like the SDL front end's: with FLIP_SCREEN in render order, else turned
+// 180 degrees
+uint8_t* Visualizer::rowTarget(int y, int &pixelStride) {
+  uint8_t *line = frame + targetRow(y) * pitch;
+#ifdef FLIP_SCREEN
+  pixelStride = 4;
+  return line;
+#else
+  pixelStride = -4;
+  return line + (w - 1) * 4;
+#endif
+}
+
+void Visualizer::drawRow(int y, uint8_t *pixels, int pixelStride, int step) {
+  if (step <= 1) return;
+  stretchRow(pixels, pixelStride, w, step);
+  const uint8_t *line = frame + targetRow(y) * pitch;
+  for (int dy = 1; dy < step && y + dy < h; ++dy) {
+    memcpy(frame + targetRow(y + dy) * pitch, line, w * 4);
+  }
+}
+
+bool Visualizer::promptLongPress(const char *q) {
+  openInputs();
+  // nobody to answer
+  if (!numInputs) return false;
+  fprintf(stderr, "%s\n", q);
+  static bool keys[KEY_CNT];
+  memset(keys, 0, sizeof(keys));
+  int currentlyDown = 0;
+  bool pressed = false;
+  bool result = false;
+  while (!pressed || currentlyDown > 0) {
+    int code, value;
+    bool firstEvent = true;
+    while (nextKey(firstEvent ? -1 : 0, code, value)) {
+      firstEvent = false;
+      if (code < 0 || code >= KEY_CNT) continue;
+      if (value) {
+        pressed = true;
+        if (!keys[code]) {
+          keys[code] = true;
+          ++currentlyDown;
+          if (currentlyDown >= 2) result = !result;
+        }
+      } else if (keys[code]) {
+        keys[code] = false;
+        --currentlyDown;
+      }
+    }
+    if (pressed) {
+#ifdef FLIP_SCREEN
+      bool grayOnRight = result;
+#else
+      bool grayOnRight = !result;
+#endif
+      fill(grayOnRight ? w >> 1 : 0, 0, w >> 1, h, 0xff404040U);
+      fill(!grayOnRight ? w >> 1 : 0, 0, w >> 1, h, 0xff000000U);
+    }
+  }
+  fill(0, 0, w, h, 0xff000000U);
+  return result;
+}
+
+bool shouldQuit() {
+  static int lastKey = -1;
+  int code, value;
+  while (nextKey(0, code, value)) {
+    if (!value) {
+      lastKey = code;
+    } else if (code == KEY_ESC || code == lastKey) {
+      return true;
+    }
+  }
+  return false;
+}
+
+#endif
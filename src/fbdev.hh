@@ -0,0 +1,69 @@
+#pragma once
+
+#ifdef USE_FBDEV
+
+#include <stdint.h>
+
+#include "renderer.hh"
+
+#ifdef MIYOO
+#define FLIP_SCREEN
+#endif
+
+// The front end of the USE_FBDEV builds, for Linux handhelds without SDL:
+// the renderer writes straight into the mmapped framebuffer ($FRAMEBUFFER
+// or /dev/fb0), there is nothing to copy or present, and the keys and
+// buttons come from the evdev devices. The framebuffer has to be 32 bits
+// per pixel and at least as big as the frame, which is centered on its
+// visible page. There is no font, the diagnostic line only goes to stderr
+// like everywhere else.
+class Visualizer : public RowSink {
+  int w, h;
+  int fd;
+  uint8_t *map;
+  size_t mapBytes;
+  // pixel (0, 0) of the frame on the visible page, and the row pitch
+  uint8_t *frame;
+  int pitch;
+  // R, G, B, A in memory rather than B, G, R, A
+  bool redFirst;
+
+  inline int targetRow(int y) const {
+#ifdef FLIP_SCREEN
+    return y;
+#else
+    return h - y - 1;
+#endif
+  }
+
+  void fill(int x, int y, int width, int height, uint32_t color);
+public:
+  Visualizer(int w, int h);
+  ~Visualizer();
+
+  inline int getWidth() const {
+    return w;
+  }
+
+  inline int getHeight() const {
+    return h;
+  }
+
+  // the framebuffer's byte order
+  inline ChannelOrder channelOrder() const {
+    return redFirst ? CHANNELS_RGB : CHANNELS_BGR;
+  }
+
+  void setDiagnosticLine(const char *) { }
+
+  uint8_t* rowTarget(int y, int &pixelStride) override;
+  void drawRow(int y, uint8_t *pixels, int pixelStride, int step) override;
+  void present() override { }
+
+  bool promptLongPress(const char *q);
+};
+
+// a key was pressed twice in a row, or escape
+bool shouldQuit();
+
+#endif
@@ -0,0 +1,81 @@
+#include <math.h>
+#include <string.h>
+
+#include "irradiancecache.hh"
+#include "spatialhash.hh"
+
+namespace {
+
+// the largest radiance a sample may add, so sums can't overflow
+const float maxRadiance = 1000.0f;
+
+inline int slotOf(int marchesLeft, bool mirrorBounceAdded) {
+  return (marchesLeft > 1) * 2 + mirrorBounceAdded;
+}
+
+}
+
+IrradianceCache::IrradianceCache(float surfaceArea, float cellSize, int warmup):
+  mask(hashTableSize(surfaceArea, cellSize, 1) - 1),
+  cellSize(cellSize), invCellSize(1.0f / cellSize),
+  warmup(warmup > 0 ? warmup : 1) {
+  entries = new Entry[numEntries()];
+  clear();
+}
+
+IrradianceCache::~IrradianceCache() {
+  delete[] entries;
+}
+
+void IrradianceCache::clear() {
+  memset(entries, 0, bytes());
+}
+
+bool IrradianceCache::lookup(const float *p, const float *n, int marchesLeft,
+    bool mirrorBounceAdded, const float *u, float *rgb) const {
+  // only along the surface, off it are the cells of nothing or of other
+  // surfaces
+  float j[3], q[3];
+  for (int i = 0; i < 3; ++i) {
+    j[i] = (u[i] - 0.5f) * cellSize;
+  }
+  const float d = j[0] * n[0] + j[1] * n[1] + j[2] * n[2];
+  for (int i = 0; i < 3; ++i) {
+    q[i] = p[i] + j[i] - d * n[i];
+  }
+  const Entry *e = findEntry(entries, mask, cellKey(q, n, invCellSize, 0, 0), false);
+  if (!e) return false;
+  const int slot = slotOf(marchesLeft, mirrorBounceAdded);
+  // the sums are added before the count, so they may hold a few samples
+  // more than it says, never fewer
+  const uint32_t count = __atomic_load_n(&e->counts[slot], __ATOMIC_ACQUIRE);
+  // used with probability 1 - warmup / count, so the paths that go on
+  // keep refining it, fewer the better it gets
+  if (count < warmup || u[3] * count < warmup) return false;
+  const float scale = 1.0f / (256.0f * count);
+  for (int i = 0; i < 3; ++i) {
+    rgb[i] = __atomic_load_n(&e->sums[slot][i], __ATOMIC_RELAXED) * scale;
+  }
+  return true;
+}
+
+void IrradianceCache::record(const float *p, const float *n, int marchesLeft,
+    bool mirrorBounceAdded, const float *rgb) {
+  Entry *e = findEntry(entries, mask, cellKey(p, n, invCellSize, 0, 0), true);
+  if (!e) return;
+  const int slot = slotOf(marchesLeft, mirrorBounceAdded);
+  if (__atomic_load_n(&e->counts[slot], __ATOMIC_RELAXED) >= maxSamples) return;
+  for (int i = 0; i < 3; ++i) {
+    const float c = rgb[i] < maxRadiance ? rgb[i] : maxRadiance;
+    __atomic_fetch_add(&e->sums[slot][i], static_cast<uint32_t>(c * 256.0f + 0.5f), __ATOMIC_RELAXED);
+  }
+  __atomic_fetch_add(&e->counts[slot], 1, __ATOMIC_RELEASE);
+}
+
+int IrradianceCache::usedEntries() const {
+  int used = 0;
+  for (int i = 0; i < numEntries(); ++i) {
+    if (entries[i].key) ++used;
+  }
+  return used;
+}
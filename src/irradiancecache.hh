@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A world space cache of the light arriving at the diffuse surfaces, for
+// ending paths early. Between edits (Renderer::movePrimitive(), which
+// clears it) the scene and its lighting don't change, so the radiance a
+// path brings back from a wall is the same in every pass: the cache keeps
+// its running mean per cell of a hash grid (and dominant normal axis, so
+// the two sides of a corner stay apart), filled from the paths' diffuse
+// vertices and shared by all threads without locks.
+//
+// Paths are cut off after a few marches, so what comes back from a vertex
+// depends on the marches it has left and on whether the path still has
+// its extra mirror bounce. Each entry keeps a mean for each of those states,
+// which keeps the cached light the same as the traced light apart from
+// the blur over a cell.
+//
+// An entry is used once it has warmup samples, at first only now and
+// then, and more often the more samples it has: with probability
+// 1 - warmup / samples. The paths that go on keep refining it, up to
+// maxSamples. Bias comes from the cell size (light is averaged
+// over a cell) and from the noise of the entries, which is shared by all
+// the pixels that see them; smaller cells and a bigger warmup trade speed
+// for less of both. When the table is full new cells just aren't cached.
+class IrradianceCache {
+public:
+  // an entry stops taking samples after this many, which also bounds its
+  // fixed point sums
+  static const uint32_t maxSamples = 4096;
+private:
+  // marches left (1 or 2) times mirror bounce used or not
+  static const int numSlots = 4;
+  struct Entry {
+    // the cell and normal axis, 0 for an empty entry
+    uint64_t key;
+    // r, g, b sums in 1/256ths, then the sample counts
+    uint32_t sums[numSlots][3];
+    uint32_t counts[numSlots];
+  };
+  Entry *entries;
+  const uint32_t mask;
+  const float cellSize, invCellSize;
+  const uint32_t warmup;
+public:
+  // Sized for surfaceArea square units of surfaces cut into cells of
+  // cellSize.
+  IrradianceCache(float surfaceArea, float cellSize, int warmup);
+  ~IrradianceCache();
+
+  void clear();
+
+  // The mean radiance arriving at the diffuse surface point p with normal
+  // n, to be multiplied by its albedo, for a path with marchesLeft marches
+  // to go. u is 4 uniform numbers in [0, 1): the first three move p along
+  // the surface by up to half a cell, so the cells blend into noise
+  // instead of showing as blocks, the last picks the paths that go on.
+  // False if the entry isn't warm yet or this path should refine it.
+  bool lookup(const float *p, const float *n, int marchesLeft, bool mirrorBounceAdded,
+      const float *u, float *rgb) const;
+  // adds the radiance a path brought back to p to the entry's mean
+  void record(const float *p, const float *n, int marchesLeft, bool mirrorBounceAdded,
+      const float *rgb);
+
+  int usedEntries() const;
+  inline int numEntries() const { return static_cast<int>(mask) + 1; }
+  inline float getCellSize() const { return cellSize; }
+  inline size_t bytes() const { return sizeof(Entry) * numEntries(); }
+};
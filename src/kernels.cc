@@ -0,0 +1,88 @@
+#include <string.h>
+
+#include "kernels.hh"
+
+#define DECLARE_KERNELS(isa) \
+  namespace isa { \
+    void renderPixel(const View &view, int64_t *seed, int x, int y, \
+        int numSamples, float *rgb, uint32_t *primitives); \
+    void renderSpan(const View &view, int64_t *seed, int x, int stepX, int y, \
+        int count, int numSamples, float *rgb, uint32_t *primitives); \
+    void probeDepths(const View &view, int x, int y, int count, float *depths); \
+    void tracePhotons(const View &view, int64_t *seed, int count, int emitted); \
+  }
+
+// built with the target's own flags
+DECLARE_KERNELS(baseline)
+#ifdef KERNEL_DISPATCH
+// built from renderkernels.cc by the Makefile's KERNEL_VARIANTS rule
+DECLARE_KERNELS(sse41)
+DECLARE_KERNELS(avx2)
+DECLARE_KERNELS(avx512)
+#endif
+
+namespace {
+
+struct Variant {
+  RenderKernels kernels;
+  bool (*supported)();
+};
+
+bool always() {
+  return true;
+}
+
+#ifdef KERNEL_DISPATCH
+bool hasSse41() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("sse4.1");
+}
+
+bool hasAvx2() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+
+bool hasAvx512() {
+  __builtin_cpu_init();
+  return hasAvx2() && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl");
+}
+#endif
+
+// in order of preference, the last supported one wins
+const Variant variants[] = {
+  { { "baseline", baseline::renderPixel, baseline::renderSpan, baseline::probeDepths,
+      baseline::tracePhotons }, always },
+#ifdef KERNEL_DISPATCH
+  { { "sse4.1", sse41::renderPixel, sse41::renderSpan, sse41::probeDepths,
+      sse41::tracePhotons }, hasSse41 },
+  { { "avx2", avx2::renderPixel, avx2::renderSpan, avx2::probeDepths,
+      avx2::tracePhotons }, hasAvx2 },
+  { { "avx512", avx512::renderPixel, avx512::renderSpan, avx512::probeDepths,
+      avx512::tracePhotons }, hasAvx512 },
+#endif
+};
+
+const int numVariants = sizeof(variants) / sizeof(*variants);
+
+}
+
+const RenderKernels *selectKernels(const char *name) {
+  const bool pickBest = !name || !strcmp(name, "auto");
+  const RenderKernels *selected = nullptr;
+  for (int i = 0; i < numVariants; ++i) {
+    const Variant &v(variants[i]);
+    if ((pickBest || !strcmp(name, v.kernels.name)) && v.supported())
+      selected = &v.kernels;
+  }
+  return selected;
+}
+
+void listKernels(FILE *out) {
+  const RenderKernels *best = selectKernels(nullptr);
+  for (int i = 0; i < numVariants; ++i) {
+    const Variant &v(variants[i]);
+    fprintf(out, "  %s%s\n", v.kernels.name,
+        &v.kernels == best ? " (auto)" : v.supported() ? "" : " (not supported by this cpu)");
+  }
+}
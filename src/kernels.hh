@@ -0,0 +1,124 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+// The render kernels (scene, march, both path tracing engines, all in
+// renderkernels.cc) are compiled once per instruction set level into one
+// binary and the best one the CPU supports is picked at startup. Only
+// plain data crosses between them, each variant has its own Vec.
+
+class IrradianceCache;
+class PathGuide;
+class CausticMap;
+
+// the materials scene() tells hits apart by, and the rows of
+// View::materials
+enum MaterialId {
+  MATERIAL_WHITE,
+  MATERIAL_RED,
+  MATERIAL_GREEN,
+  MATERIAL_GOLD,
+  MATERIAL_LIGHT,
+  NUM_MATERIALS
+};
+
+// The parts of the scene that can move. The kernels report which of them
+// a pixel's paths hit, a bit each, so an edit only has to redo the pixels
+// that saw the part it moved.
+enum PrimitiveId {
+  // both rooms with their walls and light, they stay where they are
+  PRIMITIVE_ROOMS,
+  PRIMITIVE_BLOCK,
+  PRIMITIVE_SPHERE,
+  NUM_PRIMITIVES
+};
+
+const uint32_t allPrimitives = (1u << NUM_PRIMITIVES) - 1;
+
+// what can change between rows, read by scene() at every step
+struct SceneState {
+  // x, y, z, 0 from where each primitive is modeled
+  float offsets[NUM_PRIMITIVES][4];
+};
+
+// What a surface does with the light that hits it. The colors are in the
+// channel order of the output, x, y, z, 0, so the kernels never need to
+// know which channel is red.
+struct SurfaceMaterial {
+  float albedo[4];
+  // paths end at surfaces that give off light
+  float emission[4];
+  // the chance of a mirror bounce instead of a diffuse one
+  float gloss;
+  // up to this much is added to each coordinate of a mirrored direction
+  float roughness;
+};
+
+// camera setup, vectors are x, y, z, 0
+struct View {
+  float camera[4], right[4], up[4], forward[4];
+  float focusDistance, ipOffsetMultiplier;
+  int w, h;
+  // null without one, only the path engine uses it
+  IrradianceCache *cache;
+  // paths end at cached diffuse hits from this one on, 1 is the hit the
+  // camera sees
+  int cacheFrom;
+  // null without one, only the path engine uses it
+  PathGuide *guide;
+  // the share of the guided diffuse bounces that follow the guide, the
+  // others sample the cosine lobe
+  float guideFraction;
+  // null without one, only the path engine uses it
+  CausticMap *caustics;
+  // indexed by MaterialId
+  SurfaceMaterial materials[NUM_MATERIALS];
+  SceneState scene;
+};
+
+// Traces numSamples paths through pixel (x, y) and writes the sum of what
+// they brought back to rgb, and to primitives the bits (1 << PrimitiveId)
+// of everything they hit. seed is the thread's random state.
+typedef void (*RenderPixelFn)(const View &view, int64_t *seed, int x, int y,
+    int numSamples, float *rgb, uint32_t *primitives);
+
+// The wavefront engine: traces numSamples paths through each of the count
+// pixels x, x + stepX, ... of row y together, a bounce at a time, and
+// writes the sums of the pixels to rgb, 3 floats each, and their
+// primitives to primitives.
+typedef void (*RenderSpanFn)(const View &view, int64_t *seed, int x, int stepX, int y,
+    int count, int numSamples, float *rgb, uint32_t *primitives);
+
+// The distance from the camera to what the centers of the count pixels x,
+// x + 1, ... of row y see through a pinhole, for reprojecting samples from
+// one camera to another. -1 where that's a mirror, which looks different
+// from everywhere.
+typedef void (*ProbeDepthsFn)(const View &view, int x, int y, int count, float *depths);
+
+// Traces count of the emitted photons of a CausticMap build from the
+// light towards the mirrors and deposits the ones a mirror reflects onto
+// a diffuse surface in view.caustics.
+typedef void (*TracePhotonsFn)(const View &view, int64_t *seed, int count, int emitted);
+
+// paths the wavefront engine keeps in flight
+const int wavefrontBatch = 1024;
+
+// roughly the area of the scene's surfaces, both rooms, the box and the
+// sphere, to size an IrradianceCache or PathGuide
+const float sceneSurfaceArea = 4200.0f;
+
+struct RenderKernels {
+  const char *name;
+  RenderPixelFn renderPixel;
+  RenderSpanFn renderSpan;
+  ProbeDepthsFn probeDepths;
+  TracePhotonsFn tracePhotons;
+};
+
+// The variant called name, or the best one for this CPU if name is null or
+// "auto". Null if there's no such variant or the CPU can't run it.
+const RenderKernels *selectKernels(const char *name);
+
+// the variants in this binary, with the ones this CPU can't run marked
+void listKernels(FILE *out);
@@ -0,0 +1,216 @@
+#include <pthread.h>
+
+#include "cornellbox.h"
+#include "renderer.hh"
+#include "topology.hh"
+#include "kernels.hh"
+
+static_assert(CB_ACCUMULATE_FLOAT == static_cast<int>(ACCUMULATE_FLOAT) &&
+    CB_ACCUMULATE_HALF == static_cast<int>(ACCUMULATE_HALF) &&
+    CB_ACCUMULATE_RGB9E5 == static_cast<int>(ACCUMULATE_RGB9E5),
+    "cb_accumulator_format mirrors AccumulatorFormat");
+static_assert(CB_PRIMITIVE_BLOCK == static_cast<int>(PRIMITIVE_BLOCK) &&
+    CB_PRIMITIVE_SPHERE == static_cast<int>(PRIMITIVE_SPHERE),
+    "cb_primitive mirrors PrimitiveId");
+
+// All the render threads are the Renderer's own (renderOnCaller is off),
+// the threads calling in are never pinned or used for rendering.
+struct cb_renderer {
+  Renderer *renderer;
+  int samplesPerPass;
+  int passesDone;
+  // set by cb_cancel(), checked before each row
+  int cancelled;
+  bool running;
+  // a primitive was moved, the renders repair what it cleared and what
+  // add() drops later, see repair()
+  bool edited;
+  pthread_t thread;
+  // of the cb_render_async() running on thread
+  int passes, result;
+  cb_pass_callback callback;
+  void *user;
+};
+
+namespace {
+
+// Brings the pixels behind target up to it, false if cancelled. After an
+// edit pixels keep falling behind: the ones whose new samples are the
+// first to see the moved primitive drop their older ones, so the renders
+// check after every pass, but only repair when there is something to.
+bool repair(cb_renderer *r, int target) {
+  Renderer &renderer(*r->renderer);
+  if (!renderer.pixelsBehind(target)) return true;
+  for (int y = renderer.getHeight(); y--;) {
+    if (__atomic_load_n(&r->cancelled, __ATOMIC_RELAXED)) return false;
+    renderer.repairRow(y, target);
+  }
+  return true;
+}
+
+int renderPasses(cb_renderer *r, int passes, cb_pass_callback callback, void *user) {
+  Renderer &renderer(*r->renderer);
+  const int h = renderer.getHeight();
+  int done = 0;
+  if (r->edited && !repair(r, r->passesDone * r->samplesPerPass)) return done;
+  while (done < passes) {
+    const int target = (r->passesDone + 1) * r->samplesPerPass;
+    for (int y = h; y--;) {
+      if (__atomic_load_n(&r->cancelled, __ATOMIC_RELAXED)) return done;
+      renderer.renderRow(y);
+    }
+    if (r->edited && !repair(r, target)) return done;
+    ++done;
+    ++r->passesDone;
+    if (callback && callback(r, r->passesDone, user)) break;
+  }
+  return done;
+}
+
+void* renderAsync(void *rendererPtr) {
+  cb_renderer *r = static_cast<cb_renderer*>(rendererPtr);
+  r->result = renderPasses(r, r->passes, r->callback, r->user);
+  return nullptr;
+}
+
+}
+
+extern "C" {
+
+void cb_default_settings(cb_settings *settings) {
+  settings->width = 640;
+  settings->height = 480;
+  settings->samples_per_pass = 4;
+  settings->threads = 0;
+  settings->pin_threads = 1;
+  settings->numa = 1;
+  settings->performance_cores_only = 0;
+  settings->wavefront = 0;
+  settings->accumulator = CB_ACCUMULATE_FLOAT;
+  settings->kernels = nullptr;
+  settings->red_first = defaultChannelOrder == CHANNELS_RGB;
+}
+
+cb_renderer *cb_create(const cb_settings *settings) {
+  const cb_settings &s(*settings);
+  if (s.width <= 0 || s.height <= 0 || s.samples_per_pass <= 0 || s.threads < 0 ||
+      s.accumulator < CB_ACCUMULATE_FLOAT || s.accumulator > CB_ACCUMULATE_RGB9E5)
+    return nullptr;
+  const RenderKernels *kernels = selectKernels(s.kernels);
+  if (!kernels)
+    return nullptr;
+  // the same choices as the SDL front end's selectThreads() and
+  // selectNodes(), without asking
+  int cpus[Renderer::maxNumThreads];
+  float speeds[Renderer::maxNumThreads];
+  int nodes[Renderer::maxNumThreads];
+  CpuTopology topology;
+  const int available = topology.select(cpus, Renderer::maxNumThreads, s.performance_cores_only);
+  int numThreads = s.threads > 0 ? s.threads : available > 0 ? available : 2;
+  if (numThreads > Renderer::maxNumThreads) numThreads = Renderer::maxNumThreads;
+  for (int i = 0; i < numThreads; ++i) {
+    speeds[i] = i < available ? topology.relativeSpeed(cpus[i]) : 1.0f;
+  }
+  const int *pinned = s.pin_threads && numThreads <= available ? cpus : nullptr;
+  const int *nodeIds = nullptr;
+  if (s.numa && pinned && topology.nodes() > 1) {
+    for (int i = 0; i < numThreads; ++i) {
+      nodes[i] = topology.nodeOf(cpus[i]);
+    }
+    nodeIds = nodes;
+  }
+  cb_renderer *r = new cb_renderer();
+  r->renderer = new Renderer(nullptr, s.width, s.height, 0, kernels,
+      static_cast<AccumulatorFormat>(s.accumulator), s.samples_per_pass,
+      numThreads, pinned, speeds, nodeIds, false);
+  r->renderer->setWavefront(s.wavefront);
+  r->renderer->setChannelOrder(s.red_first ? CHANNELS_RGB : CHANNELS_BGR);
+  r->renderer->setClaimSize(PassScheduler::claimSize(s.samples_per_pass, numThreads,
+      s.width, r->renderer->getSamplesPerClaim()));
+  r->samplesPerPass = s.samples_per_pass;
+  return r;
+}
+
+void cb_destroy(cb_renderer *renderer) {
+  if (!renderer)
+    return;
+  cb_cancel(renderer);
+  cb_wait(renderer);
+  delete renderer->renderer;
+  delete renderer;
+}
+
+int cb_render(cb_renderer *renderer, int passes) {
+  if (renderer->running)
+    return -1;
+  __atomic_store_n(&renderer->cancelled, 0, __ATOMIC_RELAXED);
+  return renderPasses(renderer, passes, nullptr, nullptr);
+}
+
+int cb_render_async(cb_renderer *renderer, int passes,
+    cb_pass_callback callback, void *user) {
+  if (renderer->running)
+    return -1;
+  __atomic_store_n(&renderer->cancelled, 0, __ATOMIC_RELAXED);
+  renderer->passes = passes;
+  renderer->result = 0;
+  renderer->callback = callback;
+  renderer->user = user;
+  if (pthread_create(&renderer->thread, 0, renderAsync, renderer))
+    return -1;
+  renderer->running = true;
+  return 0;
+}
+
+void cb_cancel(cb_renderer *renderer) {
+  __atomic_store_n(&renderer->cancelled, 1, __ATOMIC_RELAXED);
+}
+
+int cb_wait(cb_renderer *renderer) {
+  if (!renderer->running)
+    return 0;
+  pthread_join(renderer->thread, nullptr);
+  renderer->running = false;
+  return renderer->result;
+}
+
+int cb_move_primitive(cb_renderer *renderer, cb_primitive primitive,
+    float x, float y, float z) {
+  if (renderer->running || primitive < CB_PRIMITIVE_BLOCK || primitive > CB_PRIMITIVE_SPHERE)
+    return -1;
+  const float offset[] = { x, y, z };
+  renderer->edited = true;
+  return renderer->renderer->movePrimitive(static_cast<PrimitiveId>(primitive), offset);
+}
+
+int cb_samples(const cb_renderer *renderer) {
+  return renderer->passesDone * renderer->samplesPerPass;
+}
+
+void cb_get_image(const cb_renderer *renderer, cb_image *image) {
+  const Renderer &r(*renderer->renderer);
+  image->pixels = r.getImage();
+  image->width = r.getWidth();
+  image->height = r.getHeight();
+  image->stride = r.getWidth() * 4;
+  image->red_channel = redChannel(r.getChannelOrder());
+}
+
+int cb_slice_count(const cb_renderer *renderer) {
+  return renderer->renderer->getNumSlices();
+}
+
+void cb_get_slice(const cb_renderer *renderer, int index, cb_slice *slice) {
+  const Renderer &r(*renderer->renderer);
+  const Accumulator &a(r.getSlice(index));
+  int begin, end;
+  r.sliceColumns(index, begin, end);
+  slice->data = a.data();
+  slice->counts = a.separateCounts();
+  slice->format = static_cast<cb_accumulator_format>(a.getFormat());
+  slice->x = begin;
+  slice->columns = end - begin;
+  slice->stride = a.getWidth();
+}
+
+}
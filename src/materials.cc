@@ -0,0 +1,64 @@
+#include <string.h>
+
+#include "materials.hh"
+
+namespace {
+
+const char *const orderNames[] = { "bgr", "rgb" };
+const char *const primitiveNames[] = { "rooms", "block", "sphere" };
+
+}
+
+const SurfaceMaterial sceneMaterials[NUM_MATERIALS] = {
+  // MATERIAL_WHITE
+  { { 0.3f, 0.3f, 0.3f, 0.0f }, { }, 0.0f, 0.0f },
+  // MATERIAL_RED
+  { { 0.2f, 0.01f, 0.01f, 0.0f }, { }, 0.0f, 0.0f },
+  // MATERIAL_GREEN
+  { { 0.01f, 0.2f, 0.01f, 0.0f }, { }, 0.0f, 0.0f },
+  // MATERIAL_GOLD, a slightly rough mirror
+  { { 0.98f * 0.8f, 0.72f * 0.8f, 0.16f * 0.8f, 0.0f }, { }, 1.0f, 0.1f },
+  // MATERIAL_LIGHT
+  { { }, { 50.0f, 80.0f, 100.0f, 0.0f }, 0.0f, 0.0f },
+};
+
+const char* channelOrderName(ChannelOrder order) {
+  return orderNames[order];
+}
+
+bool parseChannelOrder(const char *name, ChannelOrder &order) {
+  for (int i = 0; i < 2; ++i) {
+    if (!strcmp(name, orderNames[i])) {
+      order = static_cast<ChannelOrder>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+const char* primitiveName(PrimitiveId id) {
+  return primitiveNames[id];
+}
+
+bool parsePrimitive(const char *name, PrimitiveId &id) {
+  for (int i = 0; i < NUM_PRIMITIVES; ++i) {
+    if (!strcmp(name, primitiveNames[i])) {
+      id = static_cast<PrimitiveId>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+void orderMaterials(ChannelOrder order, SurfaceMaterial *materials) {
+  memcpy(materials, sceneMaterials, sizeof(sceneMaterials));
+  if (order == CHANNELS_RGB) return;
+  for (int i = 0; i < NUM_MATERIALS; ++i) {
+    float *colors[] = { materials[i].albedo, materials[i].emission };
+    for (float *c : colors) {
+      const float r = c[0];
+      c[0] = c[2];
+      c[2] = r;
+    }
+  }
+}
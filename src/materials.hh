@@ -0,0 +1,37 @@
+#pragma once
+
+#include "kernels.hh"
+
+// The byte order of the rendered pixels, alpha last. The kernels render in
+// it: the material colors are put in this order before rendering, so the
+// tonemapped pixels come out right for the screen without a swap.
+enum ChannelOrder {
+  CHANNELS_BGR,
+  CHANNELS_RGB,
+};
+
+#ifdef RED_BLUE_SWAP
+const ChannelOrder defaultChannelOrder = CHANNELS_RGB;
+#else
+const ChannelOrder defaultChannelOrder = CHANNELS_BGR;
+#endif
+
+// the byte of red in a pixel, blue's is 2 - that
+inline int redChannel(ChannelOrder order) {
+  return order == CHANNELS_RGB ? 0 : 2;
+}
+
+const char* channelOrderName(ChannelOrder order);
+// false if name isn't one of the channelOrderName()s
+bool parseChannelOrder(const char *name, ChannelOrder &order);
+
+const char* primitiveName(PrimitiveId id);
+// false if name isn't one of the primitiveName()s
+bool parsePrimitive(const char *name, PrimitiveId &id);
+
+// The scene's materials, colors in R, G, B. Adding one is a row here and a
+// MaterialId, the kernels only look them up.
+extern const SurfaceMaterial sceneMaterials[NUM_MATERIALS];
+
+// sceneMaterials with the colors in order
+void orderMaterials(ChannelOrder order, SurfaceMaterial *materials);
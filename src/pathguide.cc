@@ -0,0 +1,134 @@
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#if defined(__SSE__)
+#include <x86intrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "pathguide.hh"
+#include "spatialhash.hh"
+
+namespace {
+
+#include "fastmath.hh"
+
+const float TAU = 6.283185307179586f;
+// tan(pi / 8), the middle of the first octant
+const float tanEighth = 0.41421356f;
+// the largest value a bounce may add, so sums can't overflow
+const float maxValue = 4000.0f;
+
+static_assert(PathGuide::phiBins == 16, "phiBin() splits each quadrant in 4");
+
+// The sector of the angle of (x, y) around z, out of 16, without trig:
+// which quarter of its quadrant it is in from comparing the coordinates,
+// then the quadrant from their signs.
+inline int phiBin(float x, float y) {
+  const float ax = fabsf(x), ay = fabsf(y);
+  const int q = ay < ax ? (ay < tanEighth * ax ? 0 : 1) : (ax < tanEighth * ay ? 3 : 2);
+  if (y >= 0.0f) return x >= 0.0f ? q : 7 - q;
+  return x < 0.0f ? 8 + q : 15 - q;
+}
+
+inline int binOf(const float *dir) {
+  int z = static_cast<int>((dir[2] + 1.0f) * (0.5f * PathGuide::zBins));
+  if (z < 0) z = 0;
+  if (z >= PathGuide::zBins) z = PathGuide::zBins - 1;
+  return z * PathGuide::phiBins + phiBin(dir[0], dir[1]);
+}
+
+}
+
+PathGuide::PathGuide(float surfaceArea, float cellSize):
+  // two keys per cell, one per number of marches left
+  mask(hashTableSize(surfaceArea, cellSize, 2) - 1),
+  cellSize(cellSize), invCellSize(1.0f / cellSize) {
+  entries = new Entry[numEntries()];
+  clear();
+}
+
+PathGuide::~PathGuide() {
+  delete[] entries;
+}
+
+void PathGuide::clear() {
+  memset(entries, 0, bytes());
+}
+
+void PathGuide::update() {
+  for (int i = 0; i < numEntries(); ++i) {
+    Entry &e(entries[i]);
+    if (!e.key || e.records < minRecords) continue;
+    uint64_t total = 0;
+    for (int b = 0; b < numBins; ++b) {
+      total += e.sums[b];
+    }
+    if (!total) continue;
+    uint64_t before = 0;
+    for (int b = 0; b < numBins; ++b) {
+      e.cdf[b] = static_cast<float>(static_cast<double>(before) / total);
+      before += e.sums[b];
+    }
+    e.cdf[numBins] = 1.0f;
+    e.trained = true;
+  }
+}
+
+PathGuide::Entry* PathGuide::find(const float *p, const float *n, int marchesLeft) {
+  return findEntry(entries, mask, cellKey(p, n, invCellSize, 1, marchesLeft > 1), true);
+}
+
+void PathGuide::sample(const Entry *e, float u1, float u2, float *dir) const {
+  // the last bin with cdf <= u1, whose share u1 is then rescaled into
+  int lo = 0, hi = numBins;
+  while (hi - lo > 1) {
+    const int mid = (lo + hi) / 2;
+    if (e->cdf[mid] <= u1) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  const float share = e->cdf[lo + 1] - e->cdf[lo];
+  float t = share > 0.0f ? (u1 - e->cdf[lo]) / share : 0.5f;
+  if (t > 1.0f) t = 1.0f;
+  const float z = -1.0f + (lo / phiBins + t) * (2.0f / zBins);
+  float s, c;
+  sinCos((lo % phiBins + u2) * (TAU / phiBins), s, c);
+  const float r = sqrtf(fmaxf(0.0f, 1.0f - z * z));
+  dir[0] = r * c;
+  dir[1] = r * s;
+  dir[2] = z;
+}
+
+float PathGuide::pdf(const Entry *e, const float *dir) const {
+  const int b = binOf(dir);
+  return (e->cdf[b + 1] - e->cdf[b]) * (numBins / (2.0f * TAU));
+}
+
+void PathGuide::record(Entry *e, const float *dir, float value) {
+  const float v = value < maxValue ? value : maxValue;
+  if (v > 0.0f) {
+    __atomic_fetch_add(&e->sums[binOf(dir)], static_cast<uint64_t>(v * 1024.0f + 0.5f),
+        __ATOMIC_RELAXED);
+  }
+  __atomic_fetch_add(&e->records, 1, __ATOMIC_RELAXED);
+}
+
+int PathGuide::usedEntries() const {
+  int used = 0;
+  for (int i = 0; i < numEntries(); ++i) {
+    if (entries[i].key) ++used;
+  }
+  return used;
+}
+
+int PathGuide::trainedEntries() const {
+  int trained = 0;
+  for (int i = 0; i < numEntries(); ++i) {
+    if (entries[i].trained) ++trained;
+  }
+  return trained;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Learned directions for the diffuse bounces. Light gets into the rooms
+// through the ceiling patch and the doorway, and a cosine bounce finds
+// either only by chance; the guide learns per cell of a hash grid (and
+// normal axis and marches left, like IrradianceCache) where the light a
+// bounce brings back comes from, as a histogram over the sphere of
+// directions, and the bounce samples from a mix of that and the cosine
+// lobe.
+//
+// The histogram is equal area: 8 bands of z times 16 sectors of the angle
+// around z, so a bin's density is its share times bins / 4 pi. Each bounce
+// adds the luminance of the light it brought back times cos / pdf of its
+// direction to the bin of the direction: that is the same whatever the
+// direction was sampled from, so the sums never need to be thrown away
+// and get better with every pass. The threads add with atomics; the
+// distribution the bounces sample from is rebuilt from the sums by
+// update(), which the front end calls between rows, every 32 rows, so it
+// stays the same within a row.
+//
+// Unbiased: the bounce weight divides by the pdf of the mix, and the
+// cosine lobe in the mix covers the directions the histogram misses.
+class PathGuide {
+public:
+  static const int zBins = 8, phiBins = 16, numBins = zBins * phiBins;
+  // a cell is guided once this many bounces have been recorded in it
+  static const uint32_t minRecords = 128;
+  struct Entry {
+    // the cell, normal axis and marches left, 0 for an empty entry
+    uint64_t key;
+    uint32_t records;
+    // trained for guiding at the last update()
+    bool trained;
+    // luminance sums in 1/1024ths
+    uint64_t sums[numBins];
+    // cdf[i] is the share of the bins before bin i, cdf[numBins] is 1
+    float cdf[numBins + 1];
+  };
+private:
+  Entry *entries;
+  const uint32_t mask;
+  const float cellSize, invCellSize;
+public:
+  // Sized for surfaceArea square units of surfaces cut into cells of
+  // cellSize.
+  PathGuide(float surfaceArea, float cellSize);
+  ~PathGuide();
+
+  void clear();
+  // Rebuilds the distributions from what has been recorded. Not while
+  // rendering.
+  void update();
+
+  // the entry of the diffuse surface point p with normal n, for a path
+  // with marchesLeft marches to go, a new one if needed, null if the
+  // table is full
+  Entry* find(const float *p, const float *n, int marchesLeft);
+  // a direction from e's distribution for two uniform numbers in [0, 1)
+  void sample(const Entry *e, float u1, float u2, float *dir) const;
+  // the density of the unit direction dir in e's distribution
+  float pdf(const Entry *e, const float *dir) const;
+  // adds the luminance of the light that came back from the unit
+  // direction dir times cos / pdf
+  void record(Entry *e, const float *dir, float value);
+
+  int usedEntries() const;
+  int trainedEntries() const;
+  inline int numEntries() const { return static_cast<int>(mask) + 1; }
+  inline float getCellSize() const { return cellSize; }
+  inline size_t bytes() const { return sizeof(Entry) * numEntries(); }
+};
@@ -0,0 +1,199 @@
+#include "perfcounters.hh"
+
+#ifdef PERF_COUNTERS
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+namespace {
+  struct EventType {
+    uint32_t type;
+    uint64_t config;
+    const char *name;
+  };
+
+  const EventType events[] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles" },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions" },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch-misses" },
+    { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+        (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16), "L1d-misses" },
+    { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL |
+        (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16), "LLC-misses" },
+  };
+  enum { CYCLES, INSTRUCTIONS, BRANCH_MISSES, L1D_MISSES, LLC_MISSES, NUM_EVENTS };
+
+  const char *phaseNames[NUM_PHASES] = { "primary", "bounce", "tonemap", "display", "other" };
+  const char *unitNames[NUM_PHASES] = { "ray", "ray", "pixel", "call", "call" };
+
+  const int maxThreads = 256;
+
+  struct alignas(64) PerfThread {
+    bool attached;
+    int fds[NUM_EVENTS];
+    perf_event_mmap_page *pages[NUM_EVENTS];
+    uint64_t last[NUM_EVENTS];
+    int phase;
+    uint64_t totals[NUM_PHASES][NUM_EVENTS];
+    // rays, pixels or calls, depending on the phase
+    uint64_t units[NUM_PHASES];
+  };
+
+  PerfThread slots[maxThreads];
+  thread_local PerfThread *current = nullptr;
+  // set when the first thread fails to open the cycle counter
+  bool unavailable = false;
+
+  long perfEventOpen(perf_event_attr *attr) {
+    return syscall(__NR_perf_event_open, attr, 0, -1, -1, 0);
+  }
+
+  inline void compilerBarrier() {
+    asm volatile("" ::: "memory");
+  }
+
+  uint64_t readSyscall(int fd) {
+    uint64_t value = 0;
+    if (read(fd, &value, sizeof(value)) != sizeof(value)) return 0;
+    return value;
+  }
+
+  // userspace rdpmc through the mmapped control page where the kernel
+  // allows it, ~30 cycles instead of a read() syscall per phase change
+  uint64_t readCounter(int fd, perf_event_mmap_page *pc) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (pc) {
+      uint64_t count;
+      uint32_t seq;
+      do {
+        seq = pc->lock;
+        compilerBarrier();
+        uint32_t index = pc->index;
+        if (!pc->cap_user_rdpmc || !index) return readSyscall(fd);
+        int64_t offset = pc->offset;
+        uint32_t lo, hi;
+        asm volatile("rdpmc" : "=a" (lo), "=d" (hi) : "c" (index - 1));
+        int shift = 64 - pc->pmc_width;
+        int64_t pmc = static_cast<int64_t>((static_cast<uint64_t>(hi) << 32 | lo) << shift) >> shift;
+        count = offset + pmc;
+        compilerBarrier();
+      } while (pc->lock != seq);
+      return count;
+    }
+#endif
+    return readSyscall(fd);
+  }
+
+  void readAll(PerfThread &t, uint64_t *values) {
+    for (int i = 0; i < NUM_EVENTS; ++i) {
+      values[i] = t.fds[i] >= 0 ? readCounter(t.fds[i], t.pages[i]) : 0;
+    }
+  }
+
+  inline double ratio(uint64_t a, uint64_t b) {
+    return b ? static_cast<double>(a) / b : 0.0;
+  }
+}
+
+void attachPerfCounters(int thread) {
+  if (__atomic_load_n(&unavailable, __ATOMIC_RELAXED) || thread < 0 || thread >= maxThreads) return;
+  PerfThread &t(slots[thread]);
+  memset(&t, 0, sizeof(t));
+  int opened = 0;
+  for (int i = 0; i < NUM_EVENTS; ++i) {
+    t.fds[i] = -1;
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[i].type;
+    attr.config = events[i].config;
+    // user space only, that's what paranoid level 2 still allows
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    long fd = perfEventOpen(&attr);
+    if (fd < 0) {
+      if (i == CYCLES) {
+        if (!__atomic_exchange_n(&unavailable, true, __ATOMIC_RELAXED)) {
+          fprintf(stderr, "perf events unavailable (%s), see /proc/sys/kernel/perf_event_paranoid\n",
+              strerror(errno));
+        }
+        return;
+      }
+      if (thread == 0) {
+        fprintf(stderr, "perf event %s unavailable: %s\n", events[i].name, strerror(errno));
+      }
+      continue;
+    }
+    t.fds[i] = static_cast<int>(fd);
+    void *page = mmap(nullptr, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, t.fds[i], 0);
+    t.pages[i] = page == MAP_FAILED ? nullptr : static_cast<perf_event_mmap_page*>(page);
+    ++opened;
+  }
+  t.attached = opened > 0;
+  t.phase = PHASE_OTHER;
+  readAll(t, t.last);
+  current = &t;
+}
+
+void perfSwitchPhase(PerfPhase phase) {
+  PerfThread *t = current;
+  if (!t) return;
+  uint64_t values[NUM_EVENTS];
+  readAll(*t, values);
+  for (int i = 0; i < NUM_EVENTS; ++i) {
+    t->totals[t->phase][i] += values[i] - t->last[i];
+    t->last[i] = values[i];
+  }
+  t->phase = phase;
+  // rays are counted by perfMarched(), the wavefront engine switches to
+  // the primary phase more than once per ray
+  if (phase != PHASE_PRIMARY && phase != PHASE_BOUNCE) ++t->units[phase];
+}
+
+void perfMarched() {
+  PerfThread *t = current;
+  if (!t) return;
+  if (t->phase == PHASE_PRIMARY) {
+    ++t->units[PHASE_PRIMARY];
+    perfSwitchPhase(PHASE_BOUNCE);
+  } else if (t->phase == PHASE_BOUNCE) {
+    ++t->units[PHASE_BOUNCE];
+  }
+}
+
+void dumpPerfCounters(FILE *f) {
+  uint64_t totals[NUM_PHASES][NUM_EVENTS];
+  uint64_t units[NUM_PHASES];
+  memset(totals, 0, sizeof(totals));
+  memset(units, 0, sizeof(units));
+  bool any = false;
+  for (int t = 0; t < maxThreads; ++t) {
+    if (!slots[t].attached) continue;
+    any = true;
+    for (int p = 0; p < NUM_PHASES; ++p) {
+      units[p] += slots[t].units[p];
+      for (int i = 0; i < NUM_EVENTS; ++i) totals[p][i] += slots[t].totals[p][i];
+    }
+  }
+  if (!any) return;
+  fprintf(f, "Performance counters (user space, all threads):\n");
+  fprintf(f, "  %-8s %14s %14s %6s %15s %12s %12s %12s\n",
+      "phase", "cycles", "instructions", "IPC", "units", "brmiss/unit", "L1miss/unit", "LLCmiss/unit");
+  for (int p = 0; p < NUM_PHASES; ++p) {
+    const uint64_t *c = totals[p];
+    fprintf(f, "  %-8s %14llu %14llu %6.2f %9llu %-5s %9.2f %12.2f %12.3f\n", phaseNames[p],
+        (unsigned long long) c[CYCLES], (unsigned long long) c[INSTRUCTIONS],
+        ratio(c[INSTRUCTIONS], c[CYCLES]),
+        (unsigned long long) units[p], unitNames[p],
+        ratio(c[BRANCH_MISSES], units[p]), ratio(c[L1D_MISSES], units[p]),
+        ratio(c[LLC_MISSES], units[p]));
+  }
+}
+
+#endif
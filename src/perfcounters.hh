@@ -0,0 +1,49 @@
+#pragma once
+
+// Hardware performance counters per render phase, compiled in with
+// -DPERF_COUNTERS (Linux only). Every thread opens its own perf events
+// and charges the counts since the last phase change to the phase it was
+// in, so the report tells apart camera rays, bounces, tone mapping and
+// display. When perf events aren't allowed (perf_event_paranoid, no PMU
+// in a VM) it says so once and the phase markers do nothing.
+// Phases change several times per sample: where the kernel allows
+// userspace rdpmc that costs little, with the read() fallback rendering
+// is a few times slower, so compare phases, not absolute speed.
+
+#if defined(PERF_COUNTERS) && !defined(__linux__)
+#undef PERF_COUNTERS
+#endif
+
+#ifdef PERF_COUNTERS
+
+#include <stdio.h>
+
+enum PerfPhase {
+  // camera ray generation and the first march
+  PHASE_PRIMARY,
+  // the rest of the path
+  PHASE_BOUNCE,
+  // accumulating and tone mapping a pixel
+  PHASE_TONEMAP,
+  // drawing rows and presenting
+  PHASE_DISPLAY,
+  // scheduling, waiting and anything else
+  PHASE_OTHER,
+  NUM_PHASES
+};
+
+void attachPerfCounters(int thread);
+void perfSwitchPhase(PerfPhase phase);
+// a march() finished: counts a ray, the first one ends the primary phase
+void perfMarched();
+void dumpPerfCounters(FILE *f);
+
+#define PERF_PHASE(phase) perfSwitchPhase(phase)
+#define PERF_MARCHED() perfMarched()
+
+#else
+
+#define PERF_PHASE(phase) ((void) 0)
+#define PERF_MARCHED() ((void) 0)
+
+#endif
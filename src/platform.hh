@@ -1,5 +1,15 @@
 #pragma once
 
+#include "fastmath.hh"
+
+// Vec is the SSE 4.1, the NEON or the plain array (BASIC_VECTORS) version.
+// Against the plain one, for vectors with w = 0 (test/vectors.cc checks):
+//   / and sqrt()             4 ulp, exact on SSE and AArch64
+//   |, dot4                  2^-21 of the sum of the products' sizes, the
+//                            lanes are summed in another order
+//   length4                  4 ulp
+//   normalize(), !, normalize4  4 ulp of 1 per component
+
 #if defined(__SSE4_1__) && !defined(BASIC_VECTORS)
 
 #include <x86intrin.h>
@@ -34,13 +44,13 @@ struct Vec {
     }
 
     inline void normalize() {
-        __m128 f = _mm_set1_ps(1.0f / sqrtf(_mm_cvtss_f32(_mm_dp_ps(data, data, 0x71))));
+        __m128 f = _mm_set1_ps(rsqrt(_mm_cvtss_f32(_mm_dp_ps(data, data, 0x71))));
         data = _mm_mul_ps(data, f);
     }
 
     // normalize
     inline Vec operator!() const {
-      return *this * (1 / sqrtf(*this | *this));
+      return *this * rsqrt(*this | *this);
     }
     
     float length2() const {
@@ -60,6 +70,23 @@ struct Vec {
     void flatten(float *f) const { _mm_storeu_ps(f, data); }
 };
 
+// Batched helpers for four vectors at a time, see the NEON versions
+
+inline void dot4(const Vec *a, const Vec *b, float *out) {
+    for (int i = 0; i < 4; ++i)
+        out[i] = a[i] | b[i];
+}
+
+inline void length4(const Vec *v, float *out) {
+    __m128 d = _mm_setr_ps(v[0] | v[0], v[1] | v[1], v[2] | v[2], v[3] | v[3]);
+    _mm_storeu_ps(out, _mm_sqrt_ps(d));
+}
+
+inline void normalize4(Vec *v) {
+    for (int i = 0; i < 4; ++i)
+        v[i].normalize();
+}
+
 #elif defined(__ARM_NEON) && !defined(BASIC_VECTORS)
 
 #pragma message "Compiling for ARM NEON"
@@ -71,6 +98,56 @@ inline float32x4_t _makeFloat32x4(float a, float b, float c, float d) {
     return vld1q_f32(f);
 }
 
+// ARMv7 NEON has no vector divide or square root, only estimates good to
+// 8 bits. Each Newton-Raphson step doubles the correct bits, two steps get
+// within a few ulp of the IEEE result. AArch64 has the real instructions.
+inline float32x4_t _recip(float32x4_t d) {
+#ifdef __aarch64__
+    return vdivq_f32(vdupq_n_f32(1.0f), d);
+#else
+    float32x4_t r = vrecpeq_f32(d);
+    r = vmulq_f32(r, vrecpsq_f32(d, r));
+    return vmulq_f32(r, vrecpsq_f32(d, r));
+#endif
+}
+
+inline float32x4_t _div(float32x4_t n, float32x4_t d) {
+#ifdef __aarch64__
+    return vdivq_f32(n, d);
+#else
+    return vmulq_f32(n, _recip(d));
+#endif
+}
+
+inline float32x4_t _sqrt(float32x4_t v) {
+#ifdef __aarch64__
+    return vsqrtq_f32(v);
+#else
+    float32x4_t e = vrsqrteq_f32(v);
+    e = vmulq_f32(e, vrsqrtsq_f32(vmulq_f32(v, e), e));
+    e = vmulq_f32(e, vrsqrtsq_f32(vmulq_f32(v, e), e));
+    // v * 1/sqrt(v) is 0 * inf for 0, which should stay 0
+    return vbslq_f32(vceqq_f32(v, vdupq_n_f32(0.0f)), v, vmulq_f32(v, e));
+#endif
+}
+
+// 1 / sqrt(v), the lanes of rsqrt()
+inline float32x4_t _rsqrt(float32x4_t v) {
+    float32x4_t e = vrsqrteq_f32(v);
+    e = vmulq_f32(e, vrsqrtsq_f32(vmulq_f32(v, e), e));
+    return vmulq_f32(e, vrsqrtsq_f32(vmulq_f32(v, e), e));
+}
+
+// sum of all four lanes, like the BASIC_VECTORS version
+inline float _sum(float32x4_t v) {
+#ifdef __aarch64__
+    return vaddvq_f32(v);
+#else
+    float32x2_t s = vadd_f32(vget_low_f32(v), vget_high_f32(v));
+    return vget_lane_f32(vpadd_f32(s, s), 0);
+#endif
+}
+
 struct Vec {
     float32x4_t data;
 
@@ -92,32 +169,22 @@ struct Vec {
 
     inline Vec operator*(const float &r) const { return Vec(vmulq_n_f32(data, r)); }
 
-    inline Vec operator/(const Vec &r) const {
-        float f[4];
-        r.flatten(f);
-        for (int i = 0; i < 4; ++i) {
-          f[i] = vgetq_lane_f32(data, i) / f[i];
-        }
-        return Vec(f);
-    }
+    inline Vec operator/(const Vec &r) const { return Vec(_div(data, r.data)); }
 
-    inline float operator|(const Vec &r) const {
-        float32x4_t m = vmulq_f32(data, r.data);
-        return vgetq_lane_f32(m, 0) + vgetq_lane_f32(m, 1) + vgetq_lane_f32(m, 2) + vgetq_lane_f32(m, 3);
-    }
+    inline float operator|(const Vec &r) const { return _sum(vmulq_f32(data, r.data)); }
 
     inline Vec sqrt() const {
-        return Vec(vrsqrteq_f32(data));
+        return Vec(_sqrt(data));
     }
 
     inline void normalize() {
-        float scale = 1.0f / length();
+        float scale = rsqrt(length2());
         data = vmulq_n_f32(data, scale);
     }
 
     // normalize
     inline Vec operator!() const {
-      return *this * (1 / sqrtf(*this | *this));
+      return *this * rsqrt(*this | *this);
     }
     
     float length2() const {
@@ -134,12 +201,43 @@ struct Vec {
     inline float y() const { return vgetq_lane_f32(data, 1); }
     inline float z() const { return vgetq_lane_f32(data, 2); }
 
-    void flatten(float *f) const {
-      for (int i = 0; i < 4; ++i)
-        f[i] = vgetq_lane_f32(data, i);
-    }
+    void flatten(float *f) const { vst1q_f32(f, data); }
 };
 
+// Batched helpers for four vectors at a time. vld4q/vst4q transpose them
+// into one register per component on the way in and out, so the math in
+// between is lane parallel with no horizontal adds.
+
+// out[i] = a[i] | b[i]
+inline void dot4(const Vec *a, const Vec *b, float *out) {
+    float32x4x4_t p = vld4q_f32(reinterpret_cast<const float*>(a));
+    float32x4x4_t q = vld4q_f32(reinterpret_cast<const float*>(b));
+    float32x4_t d = vmulq_f32(p.val[0], q.val[0]);
+    d = vmlaq_f32(d, p.val[1], q.val[1]);
+    d = vmlaq_f32(d, p.val[2], q.val[2]);
+    d = vmlaq_f32(d, p.val[3], q.val[3]);
+    vst1q_f32(out, d);
+}
+
+// out[i] = v[i].length()
+inline void length4(const Vec *v, float *out) {
+    float d[4];
+    dot4(v, v, d);
+    vst1q_f32(out, _sqrt(vld1q_f32(d)));
+}
+
+// v[i].normalize() for all four
+inline void normalize4(Vec *v) {
+    float32x4x4_t p = vld4q_f32(reinterpret_cast<const float*>(v));
+    float32x4_t d = vmulq_f32(p.val[0], p.val[0]);
+    d = vmlaq_f32(d, p.val[1], p.val[1]);
+    d = vmlaq_f32(d, p.val[2], p.val[2]);
+    d = vmlaq_f32(d, p.val[3], p.val[3]);
+    float32x4_t scale = _rsqrt(d);
+    for (int i = 0; i < 4; ++i)
+        p.val[i] = vmulq_f32(p.val[i], scale);
+    vst4q_f32(reinterpret_cast<float*>(v), p);
+}
 
 #else
 
@@ -184,7 +282,7 @@ struct Vec {
 
     // normalize
     inline Vec operator!() const {
-      return *this * (1 / sqrtf(*this | *this));
+      return *this * rsqrt(*this | *this);
     }
     
     float length2() const {
@@ -196,7 +294,7 @@ struct Vec {
     }
 
     inline void normalize() {
-      float scale = 1.0f / length();
+      float scale = rsqrt(length2());
       data[0] = data[0] * scale;
       data[1] = data[1] * scale;
       data[2] = data[2] * scale;
@@ -224,5 +322,22 @@ struct Vec {
     }
 };
 
+// Batched helpers for four vectors at a time, see the NEON versions
+
+inline void dot4(const Vec *a, const Vec *b, float *out) {
+  for (int i = 0; i < 4; ++i)
+    out[i] = a[i] | b[i];
+}
+
+inline void length4(const Vec *v, float *out) {
+  for (int i = 0; i < 4; ++i)
+    out[i] = v[i].length();
+}
+
+inline void normalize4(Vec *v) {
+  for (int i = 0; i < 4; ++i)
+    v[i].normalize();
+}
+
 #endif
 
@@ -0,0 +1,368 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "preview.hh"
+#include "clock.hh"
+
+// elsewhere SO_NOSIGPIPE keeps a gone viewer from killing the process
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+namespace {
+
+const char magic[4] = { 'C', 'B', 'P', '1' };
+
+// how long stop() waits for the viewers to take the last frame
+const double endSeconds = 2.0;
+
+void put16(uint8_t *p, uint32_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+}
+
+void put32(uint8_t *p, uint32_t v) {
+  for (int i = 0; i < 4; ++i)
+    p[i] = v >> (i * 8);
+}
+
+bool setNonBlocking(int fd) {
+  const int flags = fcntl(fd, F_GETFL);
+  return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) >= 0;
+}
+
+int openUnixSocket(const char *path, bool listening) {
+  sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    fprintf(stderr, "The socket path %s is too long\n", path);
+    return -1;
+  }
+  strcpy(address.sun_path, path);
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    perror("socket");
+    return -1;
+  }
+  sockaddr *a = reinterpret_cast<sockaddr*>(&address);
+  if (listening) {
+    // a socket left behind by an earlier run, but nothing else
+    struct stat st;
+    if (!stat(path, &st) && S_ISSOCK(st.st_mode)) unlink(path);
+    if (!bind(fd, a, sizeof(address)) && !listen(fd, PreviewServer::maxViewers)) return fd;
+  } else if (!connect(fd, a, sizeof(address))) {
+    return fd;
+  }
+  fprintf(stderr, "Could not %s %s: %s\n", listening ? "listen on" : "connect to", path, strerror(errno));
+  close(fd);
+  return -1;
+}
+
+int openTcpSocket(const char *address, bool listening) {
+  char host[256];
+  const char *colon = strrchr(address, ':');
+  const char *port = colon ? colon + 1 : address;
+  snprintf(host, sizeof(host), "%.*s", colon ? static_cast<int>(colon - address) : 0, address);
+  char *end;
+  const long number = strtol(port, &end, 10);
+  if (*end || end == port || number <= 0 || number > 65535) {
+    fprintf(stderr, "%s is not a port, host:port or socket path\n", address);
+    return -1;
+  }
+  addrinfo hints, *found;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  const int error = getaddrinfo(colon ? host : "127.0.0.1", port, &hints, &found);
+  if (error) {
+    fprintf(stderr, "Could not resolve %s: %s\n", address, gai_strerror(error));
+    return -1;
+  }
+  int fd = -1;
+  for (addrinfo *a = found; a && fd < 0; a = a->ai_next) {
+    fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+    if (fd < 0) continue;
+    const int on = 1;
+    if (listening) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (listening ? bind(fd, a->ai_addr, a->ai_addrlen) || listen(fd, PreviewServer::maxViewers)
+        : connect(fd, a->ai_addr, a->ai_addrlen)) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(found);
+  if (fd < 0) {
+    fprintf(stderr, "Could not %s %s: %s\n", listening ? "listen on" : "connect to", address, strerror(errno));
+  }
+  return fd;
+}
+
+}
+
+size_t encodeRuns(const uint8_t *in, size_t n, uint8_t *out) {
+  uint8_t *o = out;
+  size_t i = 0;
+  while (i < n) {
+    size_t run = 0;
+    while (i + run < n && !in[i + run] && run < 128) ++run;
+    // two zeros between literals cost as much as a run
+    if (run >= 2 || (run && i + run == n)) {
+      *o++ = 127 + run;
+      i += run;
+      continue;
+    }
+    const size_t start = i;
+    while (i < n && i - start < 128 && (in[i] || (i + 1 < n && in[i + 1]))) ++i;
+    *o++ = i - start - 1;
+    memcpy(o, in + start, i - start);
+    o += i - start;
+  }
+  return o - out;
+}
+
+bool decodeRuns(const uint8_t *in, size_t bytes, uint8_t *out, size_t n) {
+  const uint8_t *end = in + bytes;
+  size_t i = 0;
+  while (in < end) {
+    const uint8_t c = *in++;
+    if (c >= 128) {
+      const size_t run = c - 127;
+      if (i + run > n) return false;
+      memset(out + i, 0, run);
+      i += run;
+    } else {
+      const size_t count = c + 1;
+      if (i + count > n || count > static_cast<size_t>(end - in)) return false;
+      memcpy(out + i, in, count);
+      in += count;
+      i += count;
+    }
+  }
+  return i == n;
+}
+
+int openPreviewSocket(const char *address, bool listen) {
+  return strchr(address, '/') ? openUnixSocket(address, listen) : openTcpSocket(address, listen);
+}
+
+PreviewServer::PreviewServer(int w, int h, double interval):
+  w(w), h(h), interval(interval), version(0), snapshotVersion(0), numViewers(0),
+  listenFd(-1), running(false), bytesSent(0), rawTileBytes(0), viewersServed(0) {
+  const size_t frameBytes = static_cast<size_t>(w) * h * 3;
+  rows = new uint8_t[frameBytes]();
+  snapshot = new uint8_t[frameBytes]();
+  delta = new uint8_t[tileSize * tileSize * 3];
+  pthread_mutex_init(&lock, nullptr);
+  wake[0] = wake[1] = -1;
+  unixPath[0] = 0;
+}
+
+PreviewServer::~PreviewServer() {
+  stop();
+  pthread_mutex_destroy(&lock);
+  delete[] rows;
+  delete[] snapshot;
+  delete[] delta;
+}
+
+bool PreviewServer::start(const char *address) {
+  listenFd = openPreviewSocket(address, true);
+  if (listenFd < 0) return false;
+  if (strchr(address, '/')) snprintf(unixPath, sizeof(unixPath), "%s", address);
+  if (!setNonBlocking(listenFd) || pipe(wake)) {
+    perror("preview");
+    return false;
+  }
+  running = !pthread_create(&thread, 0, run, this);
+  return running;
+}
+
+void PreviewServer::stop() {
+  if (running) {
+    const char c = 0;
+    while (write(wake[1], &c, 1) < 0 && errno == EINTR);
+    pthread_join(thread, nullptr);
+    running = false;
+  }
+  while (numViewers) drop(numViewers - 1);
+  if (listenFd >= 0) close(listenFd);
+  if (unixPath[0]) unlink(unixPath);
+  for (int &fd : wake) {
+    if (fd >= 0) close(fd);
+    fd = -1;
+  }
+  listenFd = -1;
+  unixPath[0] = 0;
+}
+
+void PreviewServer::updateRow(int y, const uint8_t *rgb) {
+  pthread_mutex_lock(&lock);
+  memcpy(rows + static_cast<size_t>(y) * w * 3, rgb, w * 3);
+  ++version;
+  pthread_mutex_unlock(&lock);
+}
+
+void* PreviewServer::run(void *serverPtr) {
+  static_cast<PreviewServer*>(serverPtr)->serve();
+  return nullptr;
+}
+
+size_t PreviewServer::maxUpdateBytes() const {
+  const size_t tiles = static_cast<size_t>((w + tileSize - 1) / tileSize) * ((h + tileSize - 1) / tileSize);
+  return helloSize + 4 + tiles * (8 + maxEncodedBytes(tileSize * tileSize * 3));
+}
+
+void PreviewServer::serve() {
+  double next = now();
+  // once stop() wakes the thread, when it gives up on sending the last frame
+  double end = 0.0;
+  while (true) {
+    if (end) {
+      bool sent = true;
+      for (int i = 0; i < numViewers; ++i) {
+        sent = sent && !viewers[i].outBytes && viewers[i].seen == snapshotVersion;
+      }
+      if (sent || now() > end) return;
+    }
+    pollfd fds[2 + maxViewers];
+    fds[0].fd = wake[0];
+    fds[1].fd = listenFd;
+    fds[0].events = fds[1].events = POLLIN;
+    for (int i = 0; i < numViewers; ++i) {
+      fds[2 + i].fd = viewers[i].fd;
+      fds[2 + i].events = POLLIN | (viewers[i].outBytes ? POLLOUT : 0);
+    }
+    const double wait = (end && end < next ? end : next) - now();
+    if (poll(fds, 2 + numViewers, wait > 0.0 ? static_cast<int>(wait * 1000.0) + 1 : 0) < 0) {
+      if (errno == EINTR) continue;
+      perror("preview");
+      return;
+    }
+    if (fds[0].revents & POLLIN) {
+      char c;
+      if (read(wake[0], &c, 1) < 0) return;
+      end = now() + endSeconds;
+      next = now();
+    }
+    // the viewers don't talk, anything from them is an end or an error
+    for (int i = numViewers; i--;) {
+      const short revents = fds[2 + i].revents;
+      uint8_t discard[256];
+      if ((revents & (POLLERR | POLLHUP | POLLNVAL)) ||
+          ((revents & POLLIN) && recv(viewers[i].fd, discard, sizeof(discard), MSG_DONTWAIT) <= 0) ||
+          ((revents & POLLOUT) && !flush(viewers[i]))) {
+        drop(i);
+      }
+    }
+    if (!end && (fds[1].revents & POLLIN)) acceptViewer();
+    if (now() < next) continue;
+    next = now() + interval;
+    pthread_mutex_lock(&lock);
+    if (snapshotVersion != version) {
+      memcpy(snapshot, rows, static_cast<size_t>(w) * h * 3);
+      snapshotVersion = version;
+    }
+    pthread_mutex_unlock(&lock);
+    for (int i = numViewers; i--;) {
+      if (viewers[i].outBytes || viewers[i].seen == snapshotVersion) continue;
+      update(viewers[i]);
+      if (!flush(viewers[i])) drop(i);
+    }
+  }
+}
+
+void PreviewServer::acceptViewer() {
+  const int fd = ::accept(listenFd, nullptr, nullptr);
+  if (fd < 0) return;
+  if (numViewers == maxViewers || !setNonBlocking(fd)) {
+    close(fd);
+    return;
+  }
+#ifdef SO_NOSIGPIPE
+  const int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+  Viewer &viewer(viewers[numViewers++]);
+  viewer.fd = fd;
+  viewer.frame = new uint8_t[static_cast<size_t>(w) * h * 3]();
+  viewer.out = new uint8_t[maxUpdateBytes()];
+  // the frame of zeros it starts with is a version nothing has
+  viewer.seen = ~0ULL;
+  memcpy(viewer.out, magic, 4);
+  put32(viewer.out + 4, w);
+  put32(viewer.out + 8, h);
+  put32(viewer.out + 12, tileSize);
+  viewer.outBytes = helloSize;
+  viewer.outSent = 0;
+  ++viewersServed;
+}
+
+void PreviewServer::update(Viewer &viewer) {
+  uint8_t *out = viewer.out + viewer.outBytes;
+  uint8_t *o = out + 4;
+  uint32_t tiles = 0;
+  for (int ty = 0; ty * tileSize < h; ++ty) {
+    for (int tx = 0; tx * tileSize < w; ++tx) {
+      const int x = tx * tileSize, y = ty * tileSize;
+      const int tw = w - x < tileSize ? w - x : tileSize;
+      const int th = h - y < tileSize ? h - y : tileSize;
+      const size_t rowBytes = tw * 3;
+      bool changed = false;
+      for (int j = 0; j < th && !changed; ++j) {
+        const size_t offset = (static_cast<size_t>(y + j) * w + x) * 3;
+        changed = memcmp(snapshot + offset, viewer.frame + offset, rowBytes);
+      }
+      if (!changed) continue;
+      uint8_t *d = delta;
+      for (int j = 0; j < th; ++j) {
+        const size_t offset = (static_cast<size_t>(y + j) * w + x) * 3;
+        for (size_t i = 0; i < rowBytes; ++i) {
+          d[i] = snapshot[offset + i] ^ viewer.frame[offset + i];
+        }
+        memcpy(viewer.frame + offset, snapshot + offset, rowBytes);
+        d += rowBytes;
+      }
+      const size_t bytes = encodeRuns(delta, rowBytes * th, o + 8);
+      put16(o, tx);
+      put16(o + 2, ty);
+      put32(o + 4, bytes);
+      o += 8 + bytes;
+      rawTileBytes += rowBytes * th;
+      ++tiles;
+    }
+  }
+  viewer.seen = snapshotVersion;
+  if (!tiles) return;
+  put32(out, tiles);
+  viewer.outBytes += o - out;
+}
+
+bool PreviewServer::flush(Viewer &viewer) {
+  while (viewer.outSent < viewer.outBytes) {
+    const ssize_t sent = send(viewer.fd, viewer.out + viewer.outSent,
+        viewer.outBytes - viewer.outSent, MSG_NOSIGNAL);
+    if (sent < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    viewer.outSent += sent;
+    bytesSent += sent;
+  }
+  viewer.outBytes = viewer.outSent = 0;
+  return true;
+}
+
+void PreviewServer::drop(int i) {
+  close(viewers[i].fd);
+  delete[] viewers[i].frame;
+  delete[] viewers[i].out;
+  viewers[i] = viewers[--numViewers];
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+// A live preview of the frame for viewers on a socket (see
+// tools/cbpreview.cc), for watching renders on machines without a screen.
+// The front end hands it the tonemapped rows as they are finished, it
+// sends them on from a thread of its own, at most every interval seconds
+// and only the tiles that changed since what each viewer has.
+//
+// The stream is little endian. It starts with a 16 byte hello, "CBP1"
+// then width, height and tile size as uint32s. Every update after it is
+// the number of tiles in it as a uint32, then for each tile its column
+// and row as uint16s, the length of its data as a uint32 and the data:
+// the tile's RGB rows xor what the viewer had there (zeros at first),
+// coded by encodeRuns(). The frame is top row first, like a PPM.
+//
+// A viewer that doesn't keep up isn't waited for: it gets no new update
+// until it has taken the last one, then one against what it has by then.
+class PreviewServer {
+public:
+  static const int maxViewers = 8;
+  static const int tileSize = 32;
+  static const int helloSize = 16;
+private:
+  struct Viewer {
+    int fd;
+    // the frame as the viewer has it, the version of rows it's from
+    uint8_t *frame;
+    uint64_t seen;
+    // the unsent rest of its last update
+    uint8_t *out;
+    size_t outBytes, outSent;
+  };
+  const int w, h;
+  const double interval;
+  // the rows as the front end last handed them over, guarded by lock
+  uint8_t *rows;
+  uint64_t version;
+  pthread_mutex_t lock;
+  // what the thread last took of rows, and at which version
+  uint8_t *snapshot;
+  uint64_t snapshotVersion;
+  uint8_t *delta;
+  Viewer viewers[maxViewers];
+  int numViewers;
+  int listenFd;
+  // the thread is woken up to end through wake[1]
+  int wake[2];
+  char unixPath[108];
+  pthread_t thread;
+  bool running;
+  // sent, and what the tiles in it would have been raw
+  uint64_t bytesSent, rawTileBytes;
+  int viewersServed;
+
+  static void* run(void *serverPtr);
+  void serve();
+  void acceptViewer();
+  void update(Viewer &viewer);
+  bool flush(Viewer &viewer);
+  void drop(int i);
+  size_t maxUpdateBytes() const;
+public:
+  // frames of w x h pixels, sent at most every interval seconds
+  PreviewServer(int w, int h, double interval);
+  ~PreviewServer();
+
+  // Starts listening on address (see openPreviewSocket()) and serving,
+  // false with a message on stderr if that doesn't work.
+  bool start(const char *address);
+
+  // Stops serving and drops the viewers, also done on destruction. Waits
+  // a little for them to take the last frame first.
+  void stop();
+
+  // Row y of the frame (0 is the top) is the w RGB pixels rgb. Only
+  // copies them, the encoding and sending is on the server's thread.
+  void updateRow(int y, const uint8_t *rgb);
+
+  // for the stats, only meaningful once the server has stopped
+  inline uint64_t getBytesSent() const { return bytesSent; }
+  inline uint64_t getRawTileBytes() const { return rawTileBytes; }
+  inline int getViewersServed() const { return viewersServed; }
+};
+
+// The largest encodeRuns() output for n bytes.
+inline size_t maxEncodedBytes(size_t n) {
+  return n + (n + 127) / 128;
+}
+
+// Codes n bytes as runs: a byte c below 128 is followed by c + 1 bytes as
+// they are, one from 128 up stands for c - 127 zeros. Returns the length
+// of the code in out.
+size_t encodeRuns(const uint8_t *in, size_t n, uint8_t *out);
+
+// Decodes bytes of encodeRuns() code into the n bytes at out, false if it
+// isn't the code of exactly n bytes.
+bool decodeRuns(const uint8_t *in, size_t bytes, uint8_t *out, size_t n);
+
+// A socket on address, listening if listen is set, else connected to it,
+// -1 with a message on stderr if that doesn't work. An address with a /
+// in it is a unix socket's path, else it's a TCP port, on the loopback
+// interface, or host:port.
+int openPreviewSocket(const char *address, bool listen);
@@ -0,0 +1,467 @@
+#include <stdio.h>
+#include <time.h>
+#include <string.h>
+
+#include "renderer.hh"
+#include "clock.hh"
+#include "counters.hh"
+#include "trace.hh"
+
+namespace {
+
+void* renderThread(void *localsPtr) {
+    ThreadLocals *locals = static_cast<ThreadLocals*>(localsPtr);
+#ifdef HOT_COUNTERS
+    attachHotCounters(locals->index);
+#endif
+#ifdef TRACE_EVENTS
+    char name[32];
+    snprintf(name, sizeof(name), "render %d (cpu %d)", locals->index, locals->cpu);
+    attachTraceBuffer(locals->index, name);
+#endif
+#ifdef PERF_COUNTERS
+    attachPerfCounters(locals->index);
+#endif
+    return locals->renderThread();
+}
+
+}
+
+Renderer::Renderer(RowSink *v, int w, int h, int tileSize,
+        const RenderKernels *kernels, AccumulatorFormat format,
+        int samplesCount, int numThreads,
+        const int *cpus, const float *speeds,
+        const int *nodeIds, bool renderOnCaller) :
+    w(w), h(h),
+    windowX(0), windowY(0),
+    windowW(tileSize > 0 && tileSize < w ? tileSize : w),
+    windowH(tileSize > 0 && tileSize < h ? tileSize : h),
+    maxWindowW(windowW), maxWindowH(windowH),
+    samplesCount(samplesCount),
+    camera(0.0f, 0.0f, -10.8f),
+    right((float) w / h, 0.0f),
+    up(0.0f, 1.0f),
+    forward(0.0, 0.0, 1.0),
+    image(new uint8_t[windowW*windowH*4]()),
+    rowPixels(image + (windowW - 1)*4),
+    pixelStride(-4),
+    numNodes(0),
+    step(1),
+    claim(1),
+    focalLength(36.0f / (2.0f * right.x())),
+    aperture(1.2f),
+    focusDistance(15.8f),
+    imageDistance(1.0f),
+    ipOffsetMultiplier(focalLength / (18.0f * 2.0f) / aperture),
+    numThreads(numThreads),
+    kernels(kernels),
+    wavefront(false),
+    v(v),
+    stopping(false),
+    repairTarget(0) {
+    camera.flatten(view.camera);
+    right.flatten(view.right);
+    up.flatten(view.up);
+    forward.flatten(view.forward);
+    view.focusDistance = focusDistance;
+    view.ipOffsetMultiplier = ipOffsetMultiplier;
+    view.w = w;
+    view.h = h;
+    view.cache = nullptr;
+    view.cacheFrom = 2;
+    view.guide = nullptr;
+    view.guideFraction = 0.5f;
+    view.caustics = nullptr;
+    memset(&view.scene, 0, sizeof(view.scene));
+    setChannelOrder(defaultChannelOrder);
+    for (int i = 0; i < numThreads; ++i) {
+        const int id = nodeIds ? nodeIds[i] : -1;
+        int n = 0;
+        while (n < numNodes && nodes[n].id != id) ++n;
+        if (n == numNodes) {
+            nodes[n].id = id;
+            nodes[n].numThreads = 0;
+            ++numNodes;
+        }
+        ++nodes[n].numThreads;
+        threads[i].node = n;
+    }
+    for (int n = 0; n < numNodes; ++n) {
+        NodeQueue &node(nodes[n]);
+        node.x = -1;
+        node.first = 0;
+        node.firstColumn = 0;
+        // renderRow() gives each node at most this many columns
+        const int columns = (maxWindowW * node.numThreads + numThreads - 1) / numThreads;
+        node.accumulator = new Accumulator(columns, maxWindowH, format);
+        if (numNodes > 1 && !node.accumulator->bindToNode(node.id)) {
+            fprintf(stderr, "Could not move the samples of NUMA node %d to its memory\n", node.id);
+        }
+    }
+    int64_t seed = static_cast<int64_t>(clock());
+    for (int i = numThreads; i--; ) {
+        ThreadLocals &t(threads[i]);
+        t.renderer = this;
+        t.samplesCount = samplesCount;
+        t.seed = seed;
+        sem_init(&t.ready, 0, 0);
+        sem_init(&t.restart, 0, 0);
+        t.sync = i == 0 && renderOnCaller;
+        t.index = i;
+        t.cpu = cpus ? cpus[i] : -1;
+        t.priorSpeed = speeds ? speeds[i] : 1.0f;
+        t.speed = 0.0f;
+        t.samplesRendered = 0;
+        t.busySeconds = 0.0;
+        t.spanSums = new float[maxWindowW * 3];
+        t.spanPrimitives = new uint32_t[maxWindowW];
+        if (!t.sync) {
+            pthread_create(&t.thread, 0, renderThread, &t);
+        } else {
+            t.thread = pthread_self();
+#ifdef HOT_COUNTERS
+            attachHotCounters(i);
+#endif
+#ifdef TRACE_EVENTS
+            attachTraceBuffer(i, "main");
+#endif
+#ifdef PERF_COUNTERS
+            attachPerfCounters(i);
+#endif
+        }
+        if (t.cpu >= 0 && !pinThread(t.thread, t.cpu)) {
+            fprintf(stderr, "Could not pin thread %d to cpu %d\n", i, t.cpu);
+            t.cpu = -1;
+        }
+    }
+    updateClaimWeights();
+}
+
+Renderer::~Renderer() {
+    stopping = true;
+    for (int i = 0; i < numThreads; ++i) {
+        ThreadLocals &t(threads[i]);
+        if (!t.sync) {
+            sem_post(&t.restart);
+            pthread_join(t.thread, nullptr);
+        }
+        sem_destroy(&t.restart);
+        sem_destroy(&t.ready);
+    }
+    delete[] image;
+    image = rowPixels = nullptr;
+    for (int n = 0; n < numNodes; ++n) {
+        delete nodes[n].accumulator;
+    }
+    for (int i = 0; i < numThreads; ++i) {
+        delete[] threads[i].spanSums;
+        delete[] threads[i].spanPrimitives;
+    }
+}
+
+// Faster cores claim proportionally more pixels at once, and near the
+// end of the row claims shrink to each thread's share of what's left,
+// so a slow core doesn't pick up a big chunk last and hold up the row.
+void Renderer::updateClaimWeights() {
+    bool measured = true;
+    float fastest = 0.0f;
+    for (int i = numThreads; i--; ) {
+        if (threads[i].speed <= 0.0f) measured = false;
+    }
+    for (int i = numThreads; i--; ) {
+        ThreadLocals &t(threads[i]);
+        t.claimWeight = measured ? t.speed : t.priorSpeed;
+        if (t.claimWeight > fastest) fastest = t.claimWeight;
+    }
+    float sums[maxNodes] = { };
+    for (int i = numThreads; i--; ) {
+        ThreadLocals &t(threads[i]);
+        t.claimWeight /= fastest;
+        sums[t.node] += t.claimWeight;
+    }
+    for (int i = numThreads; i--; ) {
+        threads[i].share = threads[i].claimWeight / sums[threads[i].node];
+    }
+}
+
+void Renderer::dumpParameters() {
+    fprintf(stderr, "Rendering %dx%d (samples: %d)\n", w, h, samplesCount);
+    fprintf(stderr, "Render kernels: %s, %s engine\n", kernels->name, wavefront ? "wavefront" : "path");
+    fprintf(stderr, "Channel order: %s\n", channelOrderName(channelOrder));
+    size_t bytes = 0;
+    for (int n = 0; n < numNodes; ++n) {
+        bytes += nodes[n].accumulator->bytes();
+    }
+    fprintf(stderr, "Accumulator: %s, %.1f MB\n",
+            Accumulator::formatName(nodes[0].accumulator->getFormat()), bytes / 1048576.0);
+    if (numNodes > 1) {
+        fprintf(stderr, "NUMA nodes:");
+        for (int n = 0; n < numNodes; ++n) {
+            fprintf(stderr, " %d (%d threads)", nodes[n].id, nodes[n].numThreads);
+        }
+        fprintf(stderr, "\n");
+    }
+    if (view.cache) {
+        fprintf(stderr, "Irradiance cache: %.1f MB, %g cells, from hit %d\n",
+                view.cache->bytes() / 1048576.0, view.cache->getCellSize(), view.cacheFrom);
+    }
+    if (view.guide) {
+        fprintf(stderr, "Path guide: %.1f MB, %g cells, %g%% guided\n",
+                view.guide->bytes() / 1048576.0, view.guide->getCellSize(), view.guideFraction * 100.0f);
+    }
+    if (const CausticMap *map = view.caustics) {
+        fprintf(stderr, "Caustics: %d photons in %.2fs, %.1f MB, %g cells, %d of %d entries used\n",
+                map->getPhotons(), map->buildSeconds(), map->bytes() / 1048576.0, map->getCellSize(),
+                map->usedEntries(), map->numEntries());
+        if (map->droppedPhotons()) {
+            fprintf(stderr, "Caustics: %d photons didn't fit, give the map more memory or bigger cells\n",
+                    map->droppedPhotons());
+        }
+    }
+    fprintf(stderr, "Aperture: f/%.2f\n", aperture);
+    fprintf(stderr, "Focal length: %.2f\n", focalLength);
+    fprintf(stderr, "ipOffsetMultiplier: %f\n", ipOffsetMultiplier);
+}
+
+void Renderer::dumpThreadStats() {
+    for (int i = 0; i < numThreads; ++i) {
+        ThreadLocals &t(threads[i]);
+        fprintf(stderr, "Thread %2d (cpu %3d, node %2d): %12lld samples %9.2fs busy %10.0f samples/s\n",
+                i, t.cpu, nodes[t.node].id, static_cast<long long>(t.samplesRendered), t.busySeconds,
+                t.busySeconds > 0.0 ? t.samplesRendered / t.busySeconds : 0.0);
+    }
+}
+
+void Renderer::setWindow(int x, int y, int width, int height) {
+    windowX = x;
+    windowY = y;
+    windowW = width < maxWindowW ? width : maxWindowW;
+    windowH = height < maxWindowH ? height : maxWindowH;
+    for (int n = 0; n < numNodes; ++n) {
+        nodes[n].accumulator->clear();
+    }
+}
+
+// the nodes split the columns by their number of threads, the same way
+// for every row of a window, so each column always lands in the same slice
+void Renderer::sliceColumns(int n, int &begin, int &end) const {
+    int threadsBefore = 0;
+    for (int i = 0; i < n; ++i) {
+        threadsBefore += nodes[i].numThreads;
+    }
+    begin = windowW * threadsBefore / numThreads;
+    end = windowW * (threadsBefore + nodes[n].numThreads) / numThreads;
+}
+
+void Renderer::renderRow(int y, int step) {
+    this->y = y;
+    this->step = step;
+    // the image is turned like the screen, the row is mirrored
+    rowPixels = v ? v->rowTarget(y, pixelStride) : nullptr;
+    if (!rowPixels) {
+        rowPixels = image + ((windowH - 1 - y) * windowW + windowW - 1) * 4;
+        pixelStride = -4;
+    }
+    for (int n = 0; n < numNodes; ++n) {
+        NodeQueue &node(nodes[n]);
+        int begin, end;
+        sliceColumns(n, begin, end);
+        node.firstColumn = begin;
+        // the stepped pixels with x * step in [begin, end)
+        node.first = (begin + step - 1) / step;
+        node.x = (end + step - 1) / step - 1;
+    }
+    PERF_PHASE(PHASE_OTHER);
+    updateClaimWeights();
+    ThreadLocals *syncThread = 0;
+    for (int i = numThreads; i--; ) {
+        ThreadLocals &t(threads[i]);
+        if (!t.sync) {
+            sem_post(&t.restart);
+        } else {
+            syncThread = &t;
+        }
+    }
+    if (syncThread) syncThread->renderThread();
+    {
+        TRACE_SCOPE("wait for row");
+        for (int i = numThreads; i--; ) {
+            ThreadLocals &t(threads[i]);
+            if (!t.sync) sem_wait(&t.ready);
+        }
+    }
+    if (v) v->drawRow(y, rowPixels, pixelStride, step);
+}
+
+void Renderer::repairRow(int y, int target) {
+    // nothing is behind 0, and 0 would be a whole renderRow()
+    if (target <= 0) return;
+    repairTarget = target;
+    renderRow(y);
+    repairTarget = 0;
+}
+
+int Renderer::pixelsBehind(int target) const {
+    int behind = 0;
+    for (int n = 0; n < numNodes; ++n) {
+        const Accumulator &a(*nodes[n].accumulator);
+        int begin, end;
+        sliceColumns(n, begin, end);
+        for (int y = 0; y < windowH; ++y) {
+            for (int x = 0; x < end - begin; ++x) {
+                if (a.samples(x, y) < target) ++behind;
+            }
+        }
+    }
+    return behind;
+}
+
+int Renderer::takeDroppedPixels() {
+    int dropped = 0;
+    for (int n = 0; n < numNodes; ++n) {
+        dropped += nodes[n].accumulator->takeDropped();
+    }
+    return dropped;
+}
+
+int Renderer::movePrimitive(PrimitiveId id, const float *offset) {
+    float *o = view.scene.offsets[id];
+    for (int i = 0; i < 3; ++i) {
+        o[i] = offset[i];
+    }
+    if (view.cache) view.cache->clear();
+    if (view.caustics) view.caustics->build(kernels->tracePhotons, view, numThreads);
+    int cleared = 0;
+    for (int n = 0; n < numNodes; ++n) {
+        cleared += nodes[n].accumulator->invalidate(1u << id);
+    }
+    return cleared;
+}
+
+void Renderer::setCamera(const float *position, const float *direction, float focus, float fNumber) {
+    forward = Vec(direction[0], direction[1], direction[2]);
+    forward.normalize();
+    float f[4];
+    forward.flatten(f);
+    // y x forward, or keep the old right looking straight up or down
+    Vec side(f[2], 0.0f, -f[0]);
+    if ((side | side) > 1e-12f) {
+        side.normalize();
+        right = side * ((float) w / h);
+    } else {
+        side = right;
+        side.normalize();
+    }
+    float s[4];
+    side.flatten(s);
+    up = Vec(f[1] * s[2] - f[2] * s[1], f[2] * s[0] - f[0] * s[2], f[0] * s[1] - f[1] * s[0]);
+    camera = Vec(position[0], position[1], position[2]);
+    aperture = fNumber;
+    focusDistance = focus;
+    ipOffsetMultiplier = focalLength / (18.0f * 2.0f) / aperture;
+    camera.flatten(view.camera);
+    right.flatten(view.right);
+    up.flatten(view.up);
+    forward.flatten(view.forward);
+    view.focusDistance = focusDistance;
+    view.ipOffsetMultiplier = ipOffsetMultiplier;
+}
+
+void Renderer::probeDepths(float *depths) const {
+    for (int y = 0; y < windowH; ++y) {
+        kernels->probeDepths(view, windowX, windowY + y, windowW, depths + y * windowW);
+    }
+}
+
+void Renderer::copyMeans(float *rgb) const {
+    for (int n = 0; n < numNodes; ++n) {
+        const Accumulator &a(*nodes[n].accumulator);
+        int begin, end;
+        sliceColumns(n, begin, end);
+        for (int y = 0; y < windowH; ++y) {
+            for (int x = begin; x < end; ++x) {
+                a.mean(x - begin, y, rgb + (y * windowW + x) * 3);
+            }
+        }
+    }
+}
+
+void Renderer::seedPixel(int x, int y, const float *rgb, int numSamples) {
+    int n = 0, begin, end;
+    for (; n < numNodes - 1; ++n) {
+        sliceColumns(n, begin, end);
+        if (x < end) break;
+    }
+    sliceColumns(n, begin, end);
+    const float sum[3] = { rgb[0] * numSamples, rgb[1] * numSamples, rgb[2] * numSamples };
+    uint8_t *pixel = image + ((windowH - 1 - y) * windowW + windowW - 1 - x) * 4;
+    nodes[n].accumulator->add(x - begin, y, sum, numSamples, 0, pixel);
+}
+
+void stretchRow(uint8_t *pixels, int pixelStride, int w, int step) {
+    for (int x = 0; x < w; ++x) {
+        if (x % step) memcpy(pixels + x*pixelStride, pixels + (x - x % step)*pixelStride, 4);
+    }
+}
+
+void* ThreadLocals::renderThread() {
+    while (true) {
+        if (!sync) {
+            TRACE_SCOPE("idle");
+            sem_wait(&restart);
+        }
+        if (renderer->stopping) break;
+        TRACE_SCOPE("row");
+        int claim = static_cast<int>(renderer->claim * claimWeight + 0.5f);
+        if (claim < 1) claim = 1;
+        int64_t rendered = 0;
+        double started = now();
+        // the own node's pixels first, stealing from the others, which
+        // writes to their memory, only when there are none left
+        for (int i = 0; i < renderer->numNodes; ++i) {
+            NodeQueue &queue(renderer->nodes[(node + i) % renderer->numNodes]);
+            while (true) {
+                int remaining = __atomic_load_n(&queue.x, __ATOMIC_RELAXED) + 1 - queue.first;
+                int c = static_cast<int>(remaining * share * 0.5f);
+                if (c > claim) c = claim;
+                if (c < 1) c = 1;
+                int x = __sync_fetch_and_sub(&queue.x, c);
+                if (x < queue.first) break;
+                if (renderer->wavefront && !renderer->repairTarget) {
+                    const int count = x - c < queue.first ? x - queue.first + 1 : c;
+                    const int step = renderer->step;
+                    renderer->renderSpan(queue, &seed, spanSums, spanPrimitives, (x - count + 1) * step,
+                            renderer->y, count, samplesCount);
+                    rendered += count * samplesCount;
+                    COUNT_ADD(pixels, count);
+                    COUNT_ADD(samples, count * samplesCount);
+                    continue;
+                }
+                for (int end = x - c; x > end && x >= queue.first; --x) {
+                    const int n = renderer->pixelSamples(queue, x * renderer->step, samplesCount);
+                    if (!n) continue;
+                    renderer->renderPixel(queue, &seed, x * renderer->step, renderer->y, n);
+                    rendered += n;
+                    COUNT(pixels);
+                    COUNT_ADD(samples, n);
+                }
+            }
+        }
+        PERF_PHASE(PHASE_OTHER);
+        if (rendered) {
+            double busy = now() - started;
+            samplesRendered += rendered;
+            busySeconds += busy;
+            if (busy > 0.0) {
+                float measured = rendered / busy;
+                speed = speed > 0.0f ? speed * 0.75f + measured * 0.25f : measured;
+            }
+        }
+        if (sync) {
+            break;
+        } else {
+            sem_post(&ready);
+        }
+    }
+    return nullptr;
+}
@@ -0,0 +1,362 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <semaphore.h>
+#include <pthread.h>
+
+#include "platform.hh"
+#include "scheduler.hh"
+#include "topology.hh"
+#include "perfcounters.hh"
+#include "kernels.hh"
+#include "accumulator.hh"
+#include "irradiancecache.hh"
+#include "pathguide.hh"
+#include "causticmap.hh"
+#include "materials.hh"
+
+class Renderer;
+
+static_assert(NUM_PRIMITIVES <= 4, "the Accumulator keeps 4 bits of primitives per pixel");
+
+// Where the finished rows go: the screen of the front ends, nothing for
+// the headless ones, which read the Renderer's image instead.
+class RowSink {
+public:
+    virtual ~RowSink() { }
+    // Where the tone mapped pixels of row y should go instead of the
+    // Renderer's image, so the screen doesn't need a copy of it: pixel x at
+    // the returned address plus x * pixelStride, 4 bytes in the image's
+    // byte order. Null for the image.
+    virtual uint8_t* rowTarget(int /* y */, int & /* pixelStride */) {
+        return nullptr;
+    }
+    // Row y is done, pixels and pixelStride are where its pixel 0 went and
+    // how far apart they are, step as passed to Renderer::renderRow().
+    virtual void drawRow(int y, uint8_t *pixels, int pixelStride, int step) = 0;
+    virtual void present() = 0;
+};
+
+// Copies every step-th pixel of a sparse row of w pixels over the ones up
+// to the next, for the sinks that stretch the preview over the frame.
+void stretchRow(uint8_t *pixels, int pixelStride, int w, int step);
+
+// each on its own cache line, the seed is written for every sample
+struct alignas(64) ThreadLocals {
+    pthread_t thread;
+    sem_t restart;
+    sem_t ready;
+    // random state of the render kernels
+    int64_t seed;
+    Renderer *renderer;
+    int samplesCount;
+    bool sync;
+    int index;
+    // -1 if not pinned
+    int cpu;
+    // index of the thread's NodeQueue
+    int node;
+    // pixel sums and primitives of the wavefront engine's spans
+    float *spanSums;
+    uint32_t *spanPrimitives;
+    // expected speed relative to the fastest thread until measured
+    float priorSpeed;
+    // measured samples per second of busy time, 0 until measured
+    float speed;
+    // claim size multiplier and share of its node's part of the row, set
+    // before each row
+    float claimWeight, share;
+    int64_t samplesRendered;
+    double busySeconds;
+
+    void* renderThread();
+};
+
+// A NUMA node's part of each row: the columns its threads render first,
+// into an accumulator slice in the node's memory. Its threads only take
+// pixels of the other nodes once all of its own are claimed. Without NUMA
+// there is just one of these.
+struct alignas(64) NodeQueue {
+    // the next stepped pixel to claim, counts down to first
+    int x;
+    int first;
+    // the window column of the slice's column 0
+    int firstColumn;
+    int numThreads;
+    // NUMA node, -1 if not bound to one
+    int id;
+    Accumulator *accumulator;
+};
+
+class Renderer {
+public:
+    static const int maxNumThreads = 256;
+    static const int maxNodes = CpuTopology::maxNodes;
+private:
+    friend ThreadLocals;
+    // the whole frame, the camera is set up for this
+    const int w, h;
+    // the part of the frame being rendered: the whole of it unless it's
+    // rendered in tiles, then the current tile
+    int windowX, windowY, windowW, windowH;
+    const int maxWindowW, maxWindowH;
+    int samplesCount;
+    Vec camera, right, up, forward;
+    // the tonemapped window as it is on screen, see getImage()
+    uint8_t *image;
+    // pixel 0 of the row being rendered, in image or the sink's target,
+    // and the distance to pixel 1
+    uint8_t *rowPixels;
+    int pixelStride;
+    NodeQueue nodes[maxNodes];
+    int numNodes;
+    int y, step, claim;
+    float focalLength, aperture, focusDistance, imageDistance, ipOffsetMultiplier;
+    int numThreads;
+    const RenderKernels *kernels;
+    // trace the pixels of a claim together, see RenderSpanFn
+    bool wavefront;
+    ChannelOrder channelOrder;
+    View view;
+    ThreadLocals threads[maxNumThreads];
+    // null when rendering headless
+    RowSink *v;
+    // tells the render threads to end instead of rendering another row
+    bool stopping;
+    // the samples per pixel repairRow() brings the row to, 0 in renderRow()
+    int repairTarget;
+
+    void renderPixel(NodeQueue &node, int64_t *seed, int x, int y, int numSamples) {
+        float sum[3];
+        uint32_t hit;
+        kernels->renderPixel(view, seed, windowX + x, windowY + y, numSamples, sum, &hit);
+        PERF_PHASE(PHASE_TONEMAP);
+        node.accumulator->add(x - node.firstColumn, y, sum, numSamples, hit,
+                rowPixels + x*pixelStride);
+    }
+
+    // the count pixels x, x + step, ... of row y, all of them node's
+    void renderSpan(NodeQueue &node, int64_t *seed, float *sums, uint32_t *hits, int x, int y,
+            int count, int numSamples) {
+        kernels->renderSpan(view, seed, windowX + x, step, windowY + y, count, numSamples, sums, hits);
+        PERF_PHASE(PHASE_TONEMAP);
+        for (int i = 0; i < count; ++i, x += step) {
+            node.accumulator->add(x - node.firstColumn, y, sums + i*3, numSamples, hits[i],
+                    rowPixels + x*pixelStride);
+        }
+    }
+
+    // numSamples, or in repairRow() what pixel x is missing of the target
+    inline int pixelSamples(const NodeQueue &node, int x, int numSamples) const {
+        if (!repairTarget) return numSamples;
+        const int missing = repairTarget - node.accumulator->samples(x - node.firstColumn, y);
+        return missing > 0 ? missing : 0;
+    }
+
+    void updateClaimWeights();
+public:
+    // Renders a w x h frame, shown on v if there is one. Only a tileSize
+    // square window of it is kept in memory if tileSize is given, see
+    // setWindow(). cpus, speeds (relative to the fastest) and NUMA nodes
+    // are per thread and optional. Thread 0 is the one calling renderRow()
+    // unless renderOnCaller is false, then every render thread is a new
+    // one and the caller only waits for them.
+    Renderer(RowSink *v, int w, int h, int tileSize,
+            const RenderKernels *kernels, AccumulatorFormat format,
+            int samplesCount, int numThreads,
+            const int *cpus = nullptr, const float *speeds = nullptr,
+            const int *nodeIds = nullptr, bool renderOnCaller = true);
+    ~Renderer();
+
+    void dumpParameters();
+    void dumpThreadStats();
+
+    // only call between rows, the worker threads read these unguarded
+    void setSamplesPerPass(int samples) {
+        samplesCount = samples;
+        for (int i = numThreads; i--; ) {
+            threads[i].samplesCount = samples;
+        }
+    }
+
+    void setClaimSize(int pixels) {
+        claim = pixels;
+    }
+
+    void setWavefront(bool enabled) {
+        wavefront = enabled;
+    }
+
+    // The byte order of the pixels, defaultChannelOrder unless set. The
+    // samples so far (and an irradiance cache's) are in the old one, so
+    // only before rendering.
+    void setChannelOrder(ChannelOrder order) {
+        channelOrder = order;
+        orderMaterials(order, view.materials);
+    }
+
+    inline ChannelOrder getChannelOrder() const {
+        return channelOrder;
+    }
+
+    // Ends paths at cached diffuse hits from hit firstHit on (1 is the one
+    // the camera sees), null turns the cache off. Only the path engine has
+    // one, the cache isn't the Renderer's.
+    void setIrradianceCache(IrradianceCache *cache, int firstHit) {
+        view.cache = cache;
+        view.cacheFrom = firstHit;
+    }
+
+    inline const IrradianceCache* getIrradianceCache() const {
+        return view.cache;
+    }
+
+    // Samples fraction of the diffuse bounces from guide where it has
+    // learned enough, null turns guiding off. Only the path engine, and
+    // guide->update() is the caller's, between rows.
+    void setPathGuide(PathGuide *guide, float fraction) {
+        view.guide = guide;
+        view.guideFraction = fraction;
+    }
+
+    inline const PathGuide* getPathGuide() const {
+        return view.guide;
+    }
+
+    // Adds the caustics of map, null turns them off. Its photons are
+    // traced right away with the render threads' count of threads, and
+    // again after every movePrimitive(), so after setChannelOrder(). Only
+    // the path engine, the map isn't the Renderer's.
+    void setCausticMap(CausticMap *map) {
+        view.caustics = map;
+        if (map) map->build(kernels->tracePhotons, view, numThreads);
+    }
+
+    inline const CausticMap* getCausticMap() const {
+        return view.caustics;
+    }
+
+    // Puts primitive id at offset (x, y, z) from where it's modeled and
+    // drops the samples of the pixels whose paths hit it, returns how
+    // many. The others keep theirs, until one of their new samples hits it
+    // in its new place. An irradiance cache is cleared, its light came
+    // from everywhere, and a caustic map traced again. Only between rows.
+    int movePrimitive(PrimitiveId id, const float *offset);
+
+    inline void getPrimitiveOffset(PrimitiveId id, float *offset) const {
+        memcpy(offset, view.scene.offsets[id], 3 * sizeof(float));
+    }
+
+    // Puts the camera at position (x, y, z) looking along direction, which
+    // needn't be normalized, with the picture's up as close to the scene's
+    // y axis as it goes, focused at focus with an f-number of fNumber. The
+    // samples so far are of the old view, so between frames.
+    void setCamera(const float *position, const float *direction, float focus, float fNumber);
+
+    // the camera as the kernels see it, x, y, z, 0 each, see View
+    inline void getCamera(float *camera, float *right, float *up, float *forward) const {
+        memcpy(camera, view.camera, sizeof(view.camera));
+        memcpy(right, view.right, sizeof(view.right));
+        memcpy(up, view.up, sizeof(view.up));
+        memcpy(forward, view.forward, sizeof(view.forward));
+    }
+
+    // the window's pixels' depths, see ProbeDepthsFn, row by row in render
+    // order. On the calling thread, a march per pixel.
+    void probeDepths(float *depths) const;
+
+    // the window's pixels' means, 3 floats each like probeDepths()
+    void copyMeans(float *rgb) const;
+
+    // Adds numSamples samples of mean rgb to pixel (x, y) of the window,
+    // to start it off with what an earlier frame saw there.
+    void seedPixel(int x, int y, const float *rgb, int numSamples);
+
+    // for PassScheduler::claimSize(), the wavefront engine wants full batches
+    inline int getSamplesPerClaim() const {
+        return wavefront ? wavefrontBatch : PassScheduler::defaultSamplesPerClaim;
+    }
+
+    inline int getSamplesPerPass() const {
+        return samplesCount;
+    }
+
+    inline int getNumThreads() const {
+        return numThreads;
+    }
+
+    // Moves the window to the given part of the frame, at most tileSize
+    // square, and drops the samples of the previous one.
+    void setWindow(int x, int y, int width, int height);
+
+    // Renders every step-th pixel of row y of the window (all of them by
+    // default), coarse steps are used for the progressive preview. The
+    // pixels go to the sink's rowTarget() if it has one, else to a row of
+    // getImage(), see rowPixel().
+    void renderRow(int y, int step = 1);
+
+    // Renders the pixels of row y that have fewer than target samples up
+    // to target, with the path engine. The others are left as they are.
+    void repairRow(int y, int target);
+
+    // the pixels of the window with fewer than target samples
+    int pixelsBehind(int target) const;
+
+    // the pixels new samples dropped the older ones of since the last call
+    // (see Accumulator::add()), which repairRow() can bring back
+    int takeDroppedPixels();
+
+    // pixel x of the row renderRow() rendered last, getPixelStride() bytes
+    // after pixel x - 1 (which can be negative)
+    inline const uint8_t* rowPixel(int x) const {
+        return rowPixels + x*pixelStride;
+    }
+
+    inline int getPixelStride() const {
+        return pixelStride;
+    }
+
+    inline void present() {
+      if (v) v->present();
+    }
+
+    inline int getWidth() const {
+        return w;
+    }
+
+    inline int getHeight() const {
+        return h;
+    }
+
+    inline int getWindowWidth() const {
+        return windowW;
+    }
+
+    inline int getWindowHeight() const {
+        return windowH;
+    }
+
+    // The tonemapped window, windowW x windowH pixels in the byte order of
+    // getChannelOrder(), B, G, R, A or R, G, B, A, turned 180 degrees
+    // like the screen: its first row is row windowH - 1 of the window and
+    // each row is mirrored. A sparse renderRow() only updates every
+    // step-th pixel. Rows that went to a sink's rowTarget() aren't in it.
+    inline const uint8_t* getImage() const {
+        return image;
+    }
+
+    // The samples are split into one accumulator slice per NUMA node,
+    // slice n holds the window columns [begin, end) in render order (not
+    // turned like the image) at its own column 0.
+    inline int getNumSlices() const {
+        return numNodes;
+    }
+
+    void sliceColumns(int n, int &begin, int &end) const;
+
+    inline const Accumulator& getSlice(int n) const {
+        return *nodes[n].accumulator;
+    }
+};
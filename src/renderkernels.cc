@@ -0,0 +1,679 @@
+// The render kernels. This file is built once with the target's flags
+// and, on x86, once more per instruction set level in KERNEL_VARIANTS (see
+// the Makefile) with -DKERNEL_ISA set to the variant's name. Each copy,
+// Vec and the scene templates included, lives in its own namespace so
+// that the linker can't mix inline functions from different variants.
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <memory>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "kernels.hh"
+#include "irradiancecache.hh"
+#include "pathguide.hh"
+#include "causticmap.hh"
+#include "counters.hh"
+#include "perfcounters.hh"
+
+#ifndef KERNEL_ISA
+#define KERNEL_ISA baseline
+#endif
+
+namespace KERNEL_ISA {
+namespace {
+
+#include "platform.hh"
+#include "sdf.hh"
+
+const float TAU = 6.283185307179586f;
+const float INV_PI = 2.0f / TAU;
+
+struct Random {
+    int64_t seed;
+
+    int64_t rand() {
+        return seed = (seed * 0x5DEECE66DLL + 0xBLL) & ((1LL << 48) - 1);
+    }
+
+    float randomVal() {
+        return (rand() & ((1 << 24) - 1)) / (float) (1 << 24);
+    }
+};
+
+inline Vec load(const float *f) {
+    return Vec(f[0], f[1], f[2]);
+}
+
+namespace cornell {
+    using namespace sdf;
+
+    struct Room { static constexpr Point lo{-10, -10, -10}, hi{10, 10, 10}; };
+    struct Block { static constexpr Point lo{3, 6, -3}, hi{7, 10, 1}; };
+    // 30 degrees around the vertical axis
+    struct BlockRotation {
+        static constexpr Point x{0.8660254f, 0.0f, -0.5f}, y{0.0f, 1.0f, 0.0f}, z{0.5f, 0.0f, 0.8660254f};
+    };
+    struct Doorway { static constexpr Point lo{-3.5f, -3, -12.5f}, hi{3.5f, 10, -9}; };
+    struct OtherRoom { static constexpr Point lo{-10, -10, -22}, hi{10, 10, -12}; };
+    struct GoldSphere { static constexpr Point center{-6, 7, 5}; static constexpr float radius = 3.0f; };
+    // not in the scene, add Column<Pillar> to the union to get it back
+    struct Pillar { static constexpr Point bottom{0, -10, 0}; static constexpr float radius = 1.0f, height = 3.0f; };
+
+    // colored side walls and the light patch on the ceiling, in both rooms
+    struct Walls {
+        static constexpr float far = 1e9f;
+        static constexpr int count = 3;
+        static constexpr Decal decals[count] = {
+            { { -far, -far, -far }, { -9.9f, far, 10.0f }, MATERIAL_RED },
+            { { 9.9f, -far, -far }, { far, far, 10.0f }, MATERIAL_GREEN },
+            { { -5.0f, -far, -5.0f }, { 5.0f, -9.9f, 5.0f }, MATERIAL_LIGHT },
+        };
+    };
+
+    typedef Union<
+        // room and (rotated) box, with the doorway to the other room
+        Decals<
+            Subtract<
+                Subtract<
+                    Union<Invert<Box<Room>>,
+                        Movable<Transform<Box<Block>, BlockRotation>, PRIMITIVE_BLOCK>>,
+                    Box<Doorway>>,
+                Box<OtherRoom>>,
+            Walls>,
+        Movable<Material<Sphere<GoldSphere>, MATERIAL_GOLD>, PRIMITIVE_SPHERE>> Scene;
+}
+
+// type is the material and, above sdf::primitiveShift, the PrimitiveId
+float scene(const Vec &pos, const SceneState &state, int &type) {
+    COUNT(sceneCalls);
+    return cornell::Scene::evaluate(pos, state, type);
+}
+
+float sceneDistance(const Vec &pos, const SceneState &state) {
+    COUNT(sceneCalls);
+    return cornell::Scene::distance(pos, state);
+}
+
+// The material is looked up at every step although only the last one's
+// is used: marching on distance() alone makes GCC schedule the loop a
+// good 20% slower, the branchless decals cost a few percent.
+int march(const Vec &pos, const Vec &dir, const SceneState &state, Vec &hitPos, Vec &hitNorm) {
+    int type = 0;
+    int noHitCount = 0;
+    float d;
+    COUNT(marchCalls);
+    for (float traveled = 0.0f; traveled < 100.0f; traveled += d) {
+        COUNT(marchSteps);
+        if ((d = scene(hitPos = pos + dir * traveled, state, type)) < 0.01f || ++noHitCount > 99) {
+            if (noHitCount > 99) COUNT(marchStepCap);
+            // the normal only needs the shape, not the materials
+            hitNorm = Vec(
+                sceneDistance(hitPos + Vec(0.01f, 0.0f, 0.0f), state) - d,
+                sceneDistance(hitPos + Vec(0.0f, 0.01f, 0.0f), state) - d,
+                sceneDistance(hitPos + Vec(0.0f, 0.0f, 0.01f), state) - d
+            );
+            hitNorm.normalize();
+            return type;
+        }
+    }
+    COUNT(marchEscapes);
+    return 0;
+}
+
+// The direction (x, y, z) around the normal n, turned so that z is along
+// n. The basis is Duff et al.'s branchless one.
+inline Vec diffuseDirection(const float *n, float x, float y, float z) {
+    float g = n[2] < 0 ? -1 : 1;
+    float u = -1 / (g + n[2]);
+    float v = n[0] * n[1] * u;
+    return Vec(v, g + n[1] * n[1] * u, -n[1]) * x +
+        Vec(1 + g * n[0] * n[0] * u, g * v, -g * n[0]) * y +
+        Vec(n[0], n[1], n[2]) * z;
+}
+
+// A diffuse vertex of a path for the irradiance cache and the path guide:
+// the radiance that came back to it, times the weight of its bounce, is
+// the light the path brings back after the vertex over the attenuation up
+// to and including its albedo.
+struct PathVertex {
+    float p[4], n[4];
+    // the path's light before it, and the vertex's caustics
+    Vec before;
+    Vec attenuation;
+    int marchesLeft;
+    bool mirrorBounceAdded;
+    // the guide's entry and the direction the bounce took
+    PathGuide::Entry *guideEntry;
+    float direction[4];
+};
+
+// primitives gets the bits of what the path hits, all of them if it ends
+// at the irradiance cache, whose light came from everywhere
+Vec tracePath(Random &r, Vec origin, Vec direction, const View &view, uint32_t &primitives,
+        int bounceCount = 3) {
+    Vec sampledPosition, normal, color, attenuation = 1;
+    bool mirrorBounceAdded = false;
+    int length = 0;
+    IrradianceCache *cache = view.cache;
+    PathGuide *guide = view.guide;
+    PathVertex vertices[4];
+    int numVertices = 0;
+    const CausticMap *caustics = view.caustics;
+    // mirror bounces since the last diffuse one, -1 before the first
+    int mirrorsAfterDiffuse = -1;
+    COUNT(paths);
+    while (bounceCount--) {
+        const int hit = march(origin, direction, view.scene, sampledPosition, normal);
+        PERF_MARCHED();
+        ++length;
+        primitives |= 1u << (hit >> sdf::primitiveShift);
+        const SurfaceMaterial &m(view.materials[hit & sdf::materialMask]);
+        // the same for every material, only the numbers differ, but
+        // diffuse, mirror, light is the caustic map's
+        if (!caustics || mirrorsAfterDiffuse != 1) color = color + attenuation * load(m.emission);
+        attenuation = attenuation * load(m.albedo);
+        if (m.emission[0] + m.emission[1] + m.emission[2] > 0.0f) {
+            COUNT(lightHits);
+            break;
+        }
+        if (m.gloss >= 1.0f || (m.gloss > 0.0f && r.randomVal() < m.gloss)) {
+            if (mirrorsAfterDiffuse >= 0) ++mirrorsAfterDiffuse;
+            // a mirror with a little random roughness, the first one a path
+            // hits doesn't count as a bounce
+            if (!mirrorBounceAdded) {
+                mirrorBounceAdded = true;
+                ++bounceCount;
+            }
+            direction = direction - normal * (2.0f * (direction | normal));
+            direction.normalize();
+            origin = sampledPosition + direction * 0.1f;
+            const float spread = 2.0f * m.roughness;
+            direction = direction + Vec(r.randomVal()*spread-m.roughness, r.randomVal()*spread-m.roughness,
+                r.randomVal()*spread-m.roughness);
+            direction.normalize();
+        } else {
+            float n[4];
+            normal.flatten(n);
+            mirrorsAfterDiffuse = 0;
+            // the caustics where the path could still reach the light over
+            // a mirror, as it would have without the map
+            if (caustics && bounceCount >= (mirrorBounceAdded ? 2 : 1)) {
+                float p[4], u[3], c[3];
+                sampledPosition.flatten(p);
+                for (int i = 0; i < 3; ++i) u[i] = r.randomVal();
+                if (caustics->irradiance(p, n, u, c)) {
+                    color = color + attenuation * Vec(c[0], c[1], c[2]) * INV_PI;
+                }
+            }
+            PathVertex *vertex = nullptr;
+            if ((cache || guide) && bounceCount > 0) {
+                PathVertex &v(vertices[numVertices]);
+                sampledPosition.flatten(v.p);
+                if (cache && length >= view.cacheFrom) {
+                    float u[4], c[3];
+                    for (int i = 0; i < 4; ++i) u[i] = r.randomVal();
+                    if (cache->lookup(v.p, n, bounceCount, mirrorBounceAdded, u, c)) {
+                        color = color + attenuation * Vec(c[0], c[1], c[2]);
+                        primitives |= allPrimitives;
+                        COUNT(cacheHits);
+                        break;
+                    }
+                }
+                memcpy(v.n, n, sizeof(n));
+                v.before = color;
+                v.attenuation = attenuation;
+                v.marchesLeft = bounceCount;
+                v.mirrorBounceAdded = mirrorBounceAdded;
+                v.guideEntry = guide ? guide->find(v.p, n, bounceCount) : nullptr;
+                vertex = &v;
+                ++numVertices;
+            }
+            const float u1 = r.randomVal();
+            const float u2 = r.randomVal();
+            float x, y, z;
+            cosineHemisphere(u1, u2, x, y, z);
+            direction = diffuseDirection(n, x, y, z);
+            if (vertex && vertex->guideEntry && vertex->guideEntry->trained) {
+                // one sample of the mix of guide and cosine lobe, weighted
+                // by the albedo's share, cos / pi, over the mix's pdf
+                const PathGuide::Entry *e = vertex->guideEntry;
+                float d[4];
+                if (r.randomVal() < view.guideFraction) {
+                    guide->sample(e, u1, u2, d);
+                    direction = Vec(d[0], d[1], d[2]);
+                    COUNT(guidedBounces);
+                } else {
+                    direction.normalize();
+                    direction.flatten(d);
+                }
+                const float cosTheta = d[0] * n[0] + d[1] * n[1] + d[2] * n[2];
+                if (cosTheta <= 0.0f) {
+                    // into the surface, the path brings nothing back
+                    memcpy(vertex->direction, d, sizeof(d));
+                    break;
+                }
+                const float pdf = view.guideFraction * guide->pdf(e, d) +
+                    (1.0f - view.guideFraction) * cosTheta * INV_PI;
+                attenuation = attenuation * (cosTheta * INV_PI / pdf);
+            }
+            origin = sampledPosition + direction * 0.1f;
+            direction.normalize();
+            if (vertex) direction.flatten(vertex->direction);
+        }
+    }
+    for (int i = 0; i < numVertices; ++i) {
+        const PathVertex &v(vertices[i]);
+        float c[4];
+        ((color - v.before) / v.attenuation).flatten(c);
+        if (cache) {
+            cache->record(v.p, v.n, v.marchesLeft, v.mirrorBounceAdded, c);
+            COUNT(cacheRecords);
+        }
+        // that is the light from the bounce's direction times cos / pdf / pi
+        if (v.guideEntry) guide->record(v.guideEntry, v.direction, (c[0] + c[1] + c[2]) * (1.0f / 3.0f));
+    }
+    COUNT(pathLength[length]);
+    return color;
+}
+
+// a random ray through pixel (x, y) and the lens
+void cameraRay(const View &view, Random &r, int x, int y, Vec &origin, Vec &direction) {
+    const Vec camera(load(view.camera)), right(load(view.right)),
+        up(load(view.up)), forward(load(view.forward));
+    const int w = view.w, h = view.h;
+    // this is the subpixel we are calculating
+    float dx = r.randomVal() - 0.5f;
+    float dy = r.randomVal() - 0.5f;
+    Vec dir = right * (2.0f * (x + dx) / w - 1) + up * (1.0f - 2.0f * (y + dy) / h) + forward;
+    // dir is now projected on the focal plane
+    Vec focalPoint = camera + dir * view.focusDistance;
+    Vec ip(r.randomVal(), r.randomVal());
+    ip = ip.sqrt()*view.ipOffsetMultiplier;
+    float s, c;
+    sinCos(r.randomVal() * TAU, s, c);
+    ip = ip * Vec(c, s);
+    origin = camera + dir + right * ip.x() + up * ip.y();
+    direction = focalPoint - origin;
+    direction.normalize();
+}
+
+// The wavefront engine traces the same paths as tracePath(), but instead
+// of following one path to its end before starting the next it keeps a
+// batch of them in flight and moves the whole batch a bounce at a time
+// through separate stages: extend marches every path to its next hit,
+// the hits are sorted by material, every material is shaded in a loop of
+// its own and the paths that go on are compacted into the next batch,
+// which is then topped up with new camera paths. Each stage is a tight
+// loop over structure of arrays data without material branches, rather
+// than tracePath()'s mix of everything per path.
+namespace wavefront {
+    const int batch = wavefrontBatch;
+
+    // paths in flight
+    struct Paths {
+        float ox[batch], oy[batch], oz[batch];
+        float dx[batch], dy[batch], dz[batch];
+        // attenuation
+        float ar[batch], ag[batch], ab[batch];
+        // index of the pixel in the span
+        int pixel[batch];
+        // bounces left, marches so far
+        uint8_t bounces[batch], length[batch];
+        bool mirrorBounceAdded[batch];
+        int count;
+
+        inline Vec origin(int i) const { return Vec(ox[i], oy[i], oz[i]); }
+        inline Vec direction(int i) const { return Vec(dx[i], dy[i], dz[i]); }
+        inline Vec attenuation(int i) const { return Vec(ar[i], ag[i], ab[i]); }
+
+        // appends a path, returns its index
+        inline int add(const Vec &origin, const Vec &direction, const Vec &attenuation) {
+            float o[4], d[4], a[4];
+            origin.flatten(o);
+            direction.flatten(d);
+            attenuation.flatten(a);
+            const int i = count++;
+            ox[i] = o[0]; oy[i] = o[1]; oz[i] = o[2];
+            dx[i] = d[0]; dy[i] = d[1]; dz[i] = d[2];
+            ar[i] = a[0]; ag[i] = a[1]; ab[i] = a[2];
+            return i;
+        }
+    };
+
+    // where the paths of a batch hit, and the paths sorted by material
+    struct Hits {
+        float px[batch], py[batch], pz[batch];
+        float nx[batch], ny[batch], nz[batch];
+        int type[batch];
+        // path indices, material t's are order[first[t]] to order[first[t + 1] - 1]
+        int order[batch];
+        int first[NUM_MATERIALS + 1];
+
+        inline Vec position(int i) const { return Vec(px[i], py[i], pz[i]); }
+        inline Vec normal(int i) const { return Vec(nx[i], ny[i], nz[i]); }
+    };
+
+    // the random numbers and local directions of the diffuse bounces
+    struct Bounces {
+        float u1[batch], u2[batch];
+        float x[batch], y[batch], z[batch];
+        // the mirror bounces of a material while splitLobes() sorts them
+        int mirrored[batch];
+    };
+
+    struct State {
+        Paths paths[2];
+        Hits hits;
+        Bounces bounces;
+    };
+
+    // Tops paths up to a full batch with camera paths for the samples of
+    // the span that haven't been started, started counts them. A pixel's
+    // samples are started one after the other.
+    void generate(const View &view, Random &r, int x, int stepX, int y, int count,
+            int numSamples, int &started, Paths &paths) {
+        const int total = count * numSamples;
+        for (; paths.count < batch && started < total; ++started) {
+            const int pixel = started / numSamples;
+            Vec origin, direction;
+            cameraRay(view, r, x + pixel * stepX, y, origin, direction);
+            const int i = paths.add(origin, direction, Vec(1.0f));
+            paths.pixel[i] = pixel;
+            paths.bounces[i] = 3;
+            paths.length[i] = 0;
+            paths.mirrorBounceAdded[i] = false;
+            COUNT(paths);
+        }
+    }
+
+    // marches every path, and adds what it hit to its pixel's primitives.
+    // The paths from firstCamera on are new camera paths, their marches are
+    // the primary phase, the others' the bounce phase.
+    void extend(const SceneState &state, const Paths &paths, int firstCamera, Hits &hits,
+            uint32_t *primitives) {
+        if (firstCamera > 0) PERF_PHASE(PHASE_BOUNCE);
+        for (int i = 0; i < paths.count; ++i) {
+            if (i >= firstCamera) PERF_PHASE(PHASE_PRIMARY);
+            Vec position, normal;
+            const int hit = march(paths.origin(i), paths.direction(i), state, position, normal);
+            PERF_MARCHED();
+            hits.type[i] = hit & sdf::materialMask;
+            primitives[paths.pixel[i]] |= 1u << (hit >> sdf::primitiveShift);
+            float p[4], n[4];
+            position.flatten(p);
+            normal.flatten(n);
+            hits.px[i] = p[0]; hits.py[i] = p[1]; hits.pz[i] = p[2];
+            hits.nx[i] = n[0]; hits.ny[i] = n[1]; hits.nz[i] = n[2];
+        }
+    }
+
+    // a counting sort, paths of the same material keep their order
+    void sortByMaterial(int count, Hits &hits) {
+        int next[NUM_MATERIALS] = { };
+        for (int i = 0; i < count; ++i) {
+            ++next[hits.type[i]];
+        }
+        hits.first[0] = 0;
+        for (int t = 0; t < NUM_MATERIALS; ++t) {
+            hits.first[t + 1] = hits.first[t] + next[t];
+            next[t] = hits.first[t];
+        }
+        for (int i = 0; i < count; ++i) {
+            hits.order[next[hits.type[i]]++] = i;
+        }
+    }
+
+    // Continues path i of paths in next after a bounce, unless that was its
+    // last one. mirrorBounce: the path hit a mirror for the first time.
+    inline void bounce(const Paths &paths, int i, bool mirrorBounce, const Vec &origin,
+            const Vec &direction, const Vec &attenuation, Paths &next) {
+        const int bounces = paths.bounces[i] - 1 + mirrorBounce;
+        const int length = paths.length[i] + 1;
+        if (!bounces) {
+            COUNT(pathLength[length]);
+            return;
+        }
+        const int j = next.add(origin, direction, attenuation);
+        next.pixel[j] = paths.pixel[i];
+        next.bounces[j] = bounces;
+        next.length[j] = length;
+        next.mirrorBounceAdded[j] = paths.mirrorBounceAdded[i] || mirrorBounce;
+    }
+
+    // Sorts the hits order[begin] to order[end - 1] of a material into
+    // diffuse and mirror bounces, with gloss the chance of a mirror one,
+    // and returns where the mirror ones start. Only materials with a gloss
+    // between 0 and 1 need random numbers for it.
+    int splitLobes(Random &r, Hits &hits, int begin, int end, float gloss, Bounces &b) {
+        if (gloss <= 0.0f) return end;
+        if (gloss >= 1.0f) return begin;
+        int diffuse = begin, mirrored = 0;
+        for (int k = begin; k < end; ++k) {
+            const int i = hits.order[k];
+            if (r.randomVal() < gloss) {
+                b.mirrored[mirrored++] = i;
+            } else {
+                hits.order[diffuse++] = i;
+            }
+        }
+        memcpy(hits.order + diffuse, b.mirrored, mirrored * sizeof(int));
+        return diffuse;
+    }
+
+    // A cosine weighted random direction around the normal for the hits
+    // order[begin] to order[end - 1]. The local directions are made in
+    // one go.
+    void shadeDiffuse(Random &r, const Paths &paths, const Hits &hits, int begin, int end,
+            const Vec &albedo, Bounces &b, Paths &next) {
+        const int count = end - begin;
+        for (int k = 0; k < count; ++k) {
+            b.u1[k] = r.randomVal();
+            b.u2[k] = r.randomVal();
+        }
+        cosineHemisphere(b.u1, b.u2, b.x, b.y, b.z, count);
+        for (int k = 0; k < count; ++k) {
+            const int i = hits.order[begin + k];
+            const float n[3] = { hits.nx[i], hits.ny[i], hits.nz[i] };
+            Vec direction = diffuseDirection(n, b.x[k], b.y[k], b.z[k]);
+            const Vec origin = hits.position(i) + direction * 0.1f;
+            direction.normalize();
+            bounce(paths, i, false, origin, direction, paths.attenuation(i) * albedo, next);
+        }
+    }
+
+    // a mirror with a little random roughness
+    void shadeMirror(Random &r, const Paths &paths, const Hits &hits, int begin, int end,
+            const Vec &albedo, float roughness, Paths &next) {
+        const float spread = 2.0f * roughness;
+        for (int k = begin; k < end; ++k) {
+            const int i = hits.order[k];
+            const Vec normal(hits.normal(i));
+            Vec direction(paths.direction(i));
+            direction = direction - normal * (2.0f * (direction | normal));
+            direction.normalize();
+            const Vec origin = hits.position(i) + direction * 0.1f;
+            direction = direction + Vec(r.randomVal()*spread-roughness, r.randomVal()*spread-roughness,
+                r.randomVal()*spread-roughness);
+            direction.normalize();
+            bounce(paths, i, !paths.mirrorBounceAdded[i], origin, direction,
+                paths.attenuation(i) * albedo, next);
+        }
+    }
+
+    // the paths that found a light end here
+    void shadeLight(const Paths &paths, const Hits &hits, int begin, int end,
+            const Vec &emission, float *rgb) {
+        for (int k = begin; k < end; ++k) {
+            const int i = hits.order[k];
+            float c[4];
+            (paths.attenuation(i) * emission).flatten(c);
+            float *pixel = rgb + paths.pixel[i] * 3;
+            pixel[0] += c[0];
+            pixel[1] += c[1];
+            pixel[2] += c[2];
+            COUNT(lightHits);
+            COUNT(pathLength[paths.length[i] + 1]);
+        }
+    }
+
+    // every material's hits in turn, what happens to them is up to the
+    // numbers in its row of the table
+    void shade(const View &view, Random &r, const Paths &paths, Hits &hits, Bounces &b,
+            Paths &next, float *rgb) {
+        for (int t = 0; t < NUM_MATERIALS; ++t) {
+            const SurfaceMaterial &m(view.materials[t]);
+            const int begin = hits.first[t], end = hits.first[t + 1];
+            if (m.emission[0] + m.emission[1] + m.emission[2] > 0.0f) {
+                shadeLight(paths, hits, begin, end, load(m.emission), rgb);
+                continue;
+            }
+            const Vec albedo(load(m.albedo));
+            const int split = splitLobes(r, hits, begin, end, m.gloss, b);
+            shadeDiffuse(r, paths, hits, begin, split, albedo, b, next);
+            shadeMirror(r, paths, hits, split, end, albedo, m.roughness, next);
+        }
+    }
+}
+
+}
+
+void renderPixel(const View &view, int64_t *seed, int x, int y, int numSamples,
+        float *rgb, uint32_t *primitives) {
+    Random r;
+    r.seed = *seed;
+    Vec color = Vec(0.0f);
+    uint32_t hit = 0;
+    for (int i = numSamples; i--;) {
+        PERF_PHASE(PHASE_PRIMARY);
+        Vec origin, dir;
+        cameraRay(view, r, x, y, origin, dir);
+        color = color + tracePath(r, origin, dir, view, hit);
+    }
+    *seed = r.seed;
+    *primitives = hit;
+    rgb[0] = color.x();
+    rgb[1] = color.y();
+    rgb[2] = color.z();
+}
+
+void renderSpan(const View &view, int64_t *seed, int x, int stepX, int y, int count,
+        int numSamples, float *rgb, uint32_t *primitives) {
+    using namespace wavefront;
+    // a few hundred kilobytes, too much for the stack of every call or to
+    // reserve in every thread, freed when the thread ends
+    static thread_local std::unique_ptr<State> state;
+    if (!state) state.reset(new State);
+    Random r;
+    r.seed = *seed;
+    for (int i = 0; i < count * 3; ++i) {
+        rgb[i] = 0.0f;
+    }
+    for (int i = 0; i < count; ++i) {
+        primitives[i] = 0;
+    }
+    Paths *paths = &state->paths[0], *next = &state->paths[1];
+    Hits &hits(state->hits);
+    paths->count = 0;
+    int started = 0;
+    while (true) {
+        // generate() adds the camera paths after the ones still bouncing
+        const int firstCamera = paths->count;
+        PERF_PHASE(PHASE_PRIMARY);
+        generate(view, r, x, stepX, y, count, numSamples, started, *paths);
+        if (!paths->count) break;
+        extend(view.scene, *paths, firstCamera, hits, primitives);
+        PERF_PHASE(PHASE_BOUNCE);
+        sortByMaterial(paths->count, hits);
+        next->count = 0;
+        shade(view, r, *paths, hits, state->bounces, *next, rgb);
+        Paths *done = paths;
+        paths = next;
+        next = done;
+    }
+    *seed = r.seed;
+}
+
+void probeDepths(const View &view, int x, int y, int count, float *depths) {
+    const Vec camera(load(view.camera)), right(load(view.right)),
+        up(load(view.up)), forward(load(view.forward));
+    const Vec row = up * (1.0f - 2.0f * y / view.h) + forward;
+    for (int i = 0; i < count; ++i) {
+        // cameraRay()'s ray through the pixel's center and the lens' center
+        const Vec dir = right * (2.0f * (x + i) / view.w - 1) + row;
+        Vec direction(dir);
+        direction.normalize();
+        Vec hitPos, hitNorm;
+        const int hit = march(camera + dir, direction, view.scene, hitPos, hitNorm);
+        const bool mirror = view.materials[hit & sdf::materialMask].gloss > 0.0f;
+        depths[i] = mirror ? -1.0f : (hitPos - camera).length();
+    }
+}
+
+// The light is the ceiling decal, a Lambertian emitter facing down (+y),
+// and the sphere is the only mirror: the photons start at uniform points
+// of the light, in uniform directions in the cone that just holds the
+// sphere, and carry their flux over emitted photons. They take at most the
+// one mirror bounce tracePath() leaves to the map.
+void tracePhotons(const View &view, int64_t *seed, int count, int emitted) {
+    using namespace cornell;
+    CausticMap *map = view.caustics;
+    Random r;
+    r.seed = *seed;
+    const Decal *light = Walls::decals;
+    while (light->material != MATERIAL_LIGHT) ++light;
+    const float x0 = light->lo.x, z0 = light->lo.z;
+    const float width = light->hi.x - x0, depth = light->hi.z - z0;
+    const float *o = view.scene.offsets[PRIMITIVE_SPHERE];
+    const Vec center = GoldSphere::center.vec() + Vec(o[0], o[1], o[2]);
+    const Vec emission(load(view.materials[MATERIAL_LIGHT].emission));
+    for (int i = 0; i < count; ++i) {
+        Vec origin(x0 + r.randomVal() * width, Room::lo.y + 0.1f, z0 + r.randomVal() * depth);
+        Vec axis = center - origin;
+        const float distance = axis.length();
+        axis = axis / distance;
+        const float sinMax = GoldSphere::radius / distance;
+        const float cosMax = sqrtf(1.0f - sinMax * sinMax);
+        const float cosTheta = 1.0f - r.randomVal() * (1.0f - cosMax);
+        const float sinTheta = sqrtf(1.0f - cosTheta * cosTheta);
+        float s, c, a[4];
+        sinCos(r.randomVal() * TAU, s, c);
+        axis.flatten(a);
+        Vec direction = diffuseDirection(a, sinTheta * c, sinTheta * s, cosTheta);
+        const float cosLight = direction.y();
+        if (cosLight <= 0.0f) continue;
+        // Le cos / (pdf of the point * pdf of the direction)
+        Vec flux = emission * (cosLight * width * depth * TAU * (1.0f - cosMax) / emitted);
+        Vec hitPos, normal;
+        for (int bounce = 0; bounce < 2; ++bounce) {
+            const int hit = march(origin, direction, view.scene, hitPos, normal);
+            const SurfaceMaterial &m(view.materials[hit & sdf::materialMask]);
+            if (m.emission[0] + m.emission[1] + m.emission[2] > 0.0f) break;
+            if (bounce > 0 && m.gloss < 1.0f) {
+                float p[4], n[4], f[4];
+                hitPos.flatten(p);
+                normal.flatten(n);
+                flux.flatten(f);
+                map->deposit(p, n, f);
+            }
+            if (!(m.gloss >= 1.0f || (m.gloss > 0.0f && r.randomVal() < m.gloss))) break;
+            // tracePath()'s mirror
+            direction = direction - normal * (2.0f * (direction | normal));
+            direction.normalize();
+            origin = hitPos + direction * 0.1f;
+            const float spread = 2.0f * m.roughness;
+            direction = direction + Vec(r.randomVal()*spread-m.roughness, r.randomVal()*spread-m.roughness,
+                r.randomVal()*spread-m.roughness);
+            direction.normalize();
+            flux = flux * load(m.albedo);
+        }
+    }
+    *seed = r.seed;
+}
+
+}
@@ -0,0 +1,79 @@
+#include <math.h>
+
+#include "scheduler.hh"
+
+namespace {
+  // measurements older than this many seconds count half as much
+  const double halfLife = 2.0;
+}
+
+PassScheduler::PassScheduler(int64_t pixels, int samplesOverall, double passSeconds):
+    pixels(pixels),
+    samplesOverall(samplesOverall),
+    samplesDone(0),
+    fixedSamplesPerPass(0),
+    passSeconds(passSeconds),
+    recentSamples(0.0),
+    recentSeconds(0.0) {
+}
+
+void PassScheduler::setFixedSamplesPerPass(int spp) {
+  fixedSamplesPerPass = spp;
+}
+
+void PassScheduler::record(int64_t pixelSamples, double seconds) {
+  if (seconds <= 0.0) return;
+  double decay = pow(0.5, seconds / halfLife);
+  recentSamples = recentSamples * decay + pixelSamples;
+  recentSeconds = recentSeconds * decay + seconds;
+}
+
+double PassScheduler::samplesPerSecond() const {
+  return recentSeconds > 0.0 ? recentSamples / recentSeconds : 0.0;
+}
+
+int PassScheduler::nextPassSamples() const {
+  int remaining = samplesOverall - samplesDone;
+  int spp = fixedSamplesPerPass;
+  if (spp <= 0) {
+    double rate = samplesPerSecond();
+    if (rate > 0.0) {
+      spp = static_cast<int>(rate * passSeconds / pixels + 0.5);
+    } else {
+      spp = defaultSamplesPerPass;
+    }
+    if (spp < minSamplesPerPass) spp = minSamplesPerPass;
+    if (spp > maxSamplesPerPass) spp = maxSamplesPerPass;
+  }
+  if (spp > remaining) spp = remaining;
+  // don't leave a tiny last pass behind
+  if (remaining - spp < spp / 2) spp = remaining;
+  return spp;
+}
+
+void PassScheduler::finishPass(int samplesPerPass) {
+  samplesDone += samplesPerPass;
+}
+
+int PassScheduler::claimSize(int samplesPerPass, int numThreads, int rowWidth,
+    int samplesPerClaim) {
+  int claim = (samplesPerClaim + samplesPerPass - 1) / samplesPerPass;
+  int balanced = rowWidth / (numThreads * 4);
+  if (claim > balanced) claim = balanced;
+  return claim < 1 ? 1 : claim;
+}
+
+double PassScheduler::progress(int64_t pixelSamplesInPass) const {
+  double done = samplesDone + static_cast<double>(pixelSamplesInPass) / pixels;
+  return done / samplesOverall;
+}
+
+double PassScheduler::remainingSeconds(double elapsed, int64_t pixelSamplesInPass) const {
+  double p = progress(pixelSamplesInPass);
+  if (p <= 0.0 || p >= 1.0) return 0.0;
+  double rate = samplesPerSecond();
+  if (rate > 0.0) {
+    return (1.0 - p) * samplesOverall * pixels / rate;
+  }
+  return elapsed * (1.0 - p) / p;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+
+// Picks the number of samples per pixel of each pass from the measured
+// throughput, so a pass takes roughly passSeconds whatever the device:
+// slow handhelds get 1-2 spp passes that show up quickly, fast desktops
+// get fewer, coarser passes with less per-row overhead.
+class PassScheduler {
+  const int64_t pixels;
+  const int samplesOverall;
+  int samplesDone;
+  int fixedSamplesPerPass;
+  double passSeconds;
+  // time weighted running totals, older measurements fade out
+  double recentSamples, recentSeconds;
+public:
+  static const int minSamplesPerPass = 1;
+  static const int maxSamplesPerPass = 64;
+  static const int defaultSamplesPerPass = 4;
+
+  PassScheduler(int64_t pixels, int samplesOverall, double passSeconds);
+
+  // 0 lets the scheduler adapt (the default)
+  void setFixedSamplesPerPass(int spp);
+
+  // pixel samples rendered in the given time, during or outside a pass
+  void record(int64_t pixelSamples, double seconds);
+
+  int nextPassSamples() const;
+  void finishPass(int samplesPerPass);
+
+  // a claim should hold at least this many samples
+  static const int defaultSamplesPerClaim = 16;
+
+  // pixels a thread claims at once: whole rows are split into enough
+  // pieces to balance the threads, but cheap pixels are claimed in
+  // batches of at least samplesPerClaim samples to keep the shared
+  // counter uncontended (and the wavefront engine's batches full)
+  static int claimSize(int samplesPerPass, int numThreads, int rowWidth,
+      int samplesPerClaim = defaultSamplesPerClaim);
+
+  inline bool done() const { return samplesDone >= samplesOverall; }
+  inline int getSamplesDone() const { return samplesDone; }
+  inline int getSamplesOverall() const { return samplesOverall; }
+  double samplesPerSecond() const;
+
+  // progress of the full passes, partial pass included
+  double progress(int64_t pixelSamplesInPass) const;
+  // from the recent throughput, or the overall average until there is one
+  double remainingSeconds(double elapsed, int64_t pixelSamplesInPass) const;
+};
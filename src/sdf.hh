@@ -0,0 +1,261 @@
+#pragma once
+
+#include <math.h>
+
+#include "platform.hh"
+
+// Signed distance field building blocks. A scene is a type composed of
+// these templates, with its dimensions as constexpr members of parameter
+// structs, so the compiler sees the whole field as constants and can
+// inline and fold it into one function. Distances are positive in empty
+// space. Every node has
+//   distance(pos, state): the distance to the nearest surface
+//   evaluate(pos, state, material): the same distance, plus the material
+//     of the surface that's nearest (0 unless set by Material, Decals or
+//     Paint) and, above primitiveShift, the primitive it belongs to (0
+//     unless set by Movable)
+// distance() is the cheaper one when only the shape matters (normals).
+// state is the part of the scene that can change between rows, see
+// SceneState, only Movable reads it.
+
+namespace sdf {
+
+const int primitiveShift = 8;
+const int materialMask = (1 << primitiveShift) - 1;
+
+struct Point {
+  float x, y, z;
+
+  inline Vec vec() const { return Vec(x, y, z); }
+};
+
+inline float min(float a, float b) { return a < b ? a : b; }
+
+// positive inside the box: the distance to its nearest face
+inline float boxInside(const Vec &pos, const Vec &mins, const Vec &maxs) {
+  Vec d1(pos - mins);
+  Vec d2(maxs - pos);
+  float f[4];
+  d1.min(d2).flatten(f);
+  return min(min(f[0], f[1]), f[2]);
+}
+
+// P::lo, P::hi: opposite corners
+template <class P>
+struct Box {
+  static inline float distance(const Vec &pos, const SceneState & /* state */) {
+    return -boxInside(pos, P::lo.vec(), P::hi.vec());
+  }
+
+  static inline float evaluate(const Vec &pos, const SceneState &state, int &material) {
+    material = 0;
+    return distance(pos, state);
+  }
+};
+
+// P::center, P::radius
+template <class P>
+struct Sphere {
+  static inline float distance(const Vec &pos, const SceneState & /* state */) {
+    return (pos - P::center.vec()).length() - P::radius;
+  }
+
+  static inline float evaluate(const Vec &pos, const SceneState &state, int &material) {
+    material = 0;
+    return distance(pos, state);
+  }
+};
+
+// vertical cylinder standing on P::bottom, with P::radius and P::height
+template <class P>
+struct Column {
+  static inline float distance(const Vec &pos, const SceneState &state) {
+    const float ymin = P::bottom.y;
+    const float ymax = ymin + P::height;
+    float p[4];
+    pos.flatten(p);
+    float d1 = -min(p[1] - ymin, ymax - p[1]);
+    Vec v = Vec(p[0], ymin, p[2]) - P::bottom.vec();
+    float d2 = sqrtf(v | v) - P::radius;
+    return d2 > d1 ? d2 : d1;
+  }
+
+  static inline float evaluate(const Vec &pos, const SceneState &state, int &material) {
+    material = 0;
+    return distance(pos, state);
+  }
+};
+
+// swaps solid and empty space, e.g. a Box turns into a room
+template <class S>
+struct Invert {
+  static inline float distance(const Vec &pos, const SceneState &state) {
+    return -S::distance(pos, state);
+  }
+
+  static inline float evaluate(const Vec &pos, const SceneState &state, int &material) {
+    return -S::evaluate(pos, state, material);
+  }
+};
+
+// the material of the nearer shape, the first one on ties
+template <class A, class B>
+struct Union {
+  static inline float distance(const Vec &pos, const SceneState &state) {
+    return min(A::distance(pos, state), B::distance(pos, state));
+  }
+
+  static inline float evaluate(const Vec &pos, const SceneState &state, int &material) {
+    float a = A::evaluate(pos, state, material);
+    int bMaterial;
+    float b = B::evaluate(pos, state, bMaterial);
+    if (b < a) {
+      material = bMaterial;
+      return b;
+    }
+    return a;
+  }
+};
+
+// A with B carved out of it, the cut faces get A's material. Spelled as
+// -min(-a, b) rather than max(a, -b): that's how the hand-written scene
+// had it and GCC schedules march's loop noticeably better this way.
+template <class A, class B>
+struct Subtract {
+  static inline float distance(const Vec &pos, const SceneState &state) {
+    return -min(-A::distance(pos, state), B::distance(pos, state));
+  }
+
+  static inline float evaluate(const Vec &pos, const SceneState &state, int &material) {
+    return -min(-A::evaluate(pos, state, material), B::distance(pos, state));
+  }
+};
+
+template <class A, class B>
+struct Intersect {
+  static inline float distance(const Vec &pos, const SceneState &state) {
+    float a = A::distance(pos, state);
+    float b = B::distance(pos, state);
+    return a > b ? a : b;
+  }
+
+  static inline float evaluate(const Vec &pos, const SceneState &state, int &material) {
+    float a = A::evaluate(pos, state, material);
+    int bMaterial;
+    float b = B::evaluate(pos, state, bMaterial);
+    if (b > a) {
+      material = bMaterial;
+      return b;
+    }
+    return a;
+  }
+};
+
+// evaluates S at M * pos, M given by where it takes the axes: M::x, M::y
+// and M::z. Only distance preserving (rotation) matrices keep S a
+// distance field.
+template <class S, class M>
+struct Transform {
+  static inline Vec apply(const Vec &pos) {
+    return M::x.vec() * pos.x() + M::y.vec() * pos.y() + M::z.vec() * pos.z();
+  }
+
+  static inline float distance(const Vec &pos, const SceneState &state) {
+    return S::distance(apply(pos), state);
+  }
+
+  static inline float evaluate(const Vec &pos, const SceneState &state, int &material) {
+    return S::evaluate(apply(pos), state, material);
+  }
+};
+
+// evaluates S at pos - P::offset
+template <class S, class P>
+struct Translate {
+  static inline float distance(const Vec &pos, const SceneState &state) {
+    return S::distance(pos - P::offset.vec(), state);
+  }
+
+  static inline float evaluate(const Vec &pos, const SceneState &state, int &material) {
+    return S::evaluate(pos - P::offset.vec(), state, material);
+  }
+};
+
+// Primitive I of SceneState: S moved by state.offsets[I], its surfaces
+// tagged with I. Goes around Material, which sets the whole material.
+template <class S, int I>
+struct Movable {
+  static inline Vec offset(const SceneState &state) {
+    const float *o = state.offsets[I];
+    return Vec(o[0], o[1], o[2]);
+  }
+
+  static inline float distance(const Vec &pos, const SceneState &state) {
+    return S::distance(pos - offset(state), state);
+  }
+
+  static inline float evaluate(const Vec &pos, const SceneState &state, int &material) {
+    float d = S::evaluate(pos - offset(state), state, material);
+    material |= I << primitiveShift;
+    return d;
+  }
+};
+
+template <class S, int M>
+struct Material {
+  static inline float distance(const Vec &pos, const SceneState &state) {
+    return S::distance(pos, state);
+  }
+
+  static inline float evaluate(const Vec &pos, const SceneState &state, int &material) {
+    material = M;
+    return S::distance(pos, state);
+  }
+};
+
+// a material for the part of a surface between the corners lo and hi
+struct Decal {
+  Point lo, hi;
+  int material;
+};
+
+// Paints the surfaces of S that are strictly inside any of the D::count
+// D::decals with its material, later decals over earlier ones, and keeps
+// their primitive. No branches: every decal is a box test and a select,
+// so more of them only make it longer.
+template <class S, class D>
+struct Decals {
+  static inline float distance(const Vec &pos, const SceneState &state) {
+    return S::distance(pos, state);
+  }
+
+  static inline float evaluate(const Vec &pos, const SceneState &state, int &material) {
+    float d = S::evaluate(pos, state, material);
+    for (int i = 0; i < D::count; ++i) {
+      const Decal &decal(D::decals[i]);
+      const int painted = (material & ~materialMask) | decal.material;
+      material = boxInside(pos, decal.lo.vec(), decal.hi.vec()) > 0.0f ? painted : material;
+    }
+    return d;
+  }
+};
+
+// P::paint(p, material) picks the material from the position p[0..2] for
+// materials that depend on where the surface is, like differently colored
+// walls of the same box
+template <class S, class P>
+struct Paint {
+  static inline float distance(const Vec &pos, const SceneState &state) {
+    return S::distance(pos, state);
+  }
+
+  static inline float evaluate(const Vec &pos, const SceneState &state, int &material) {
+    float d = S::evaluate(pos, state, material);
+    float p[4];
+    pos.flatten(p);
+    material = P::paint(p, material);
+    return d;
+  }
+};
+
+}
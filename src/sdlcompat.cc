@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "sdlcompat.hh"
 
@@ -76,7 +77,7 @@ int VideoSurface::lock(LockedSurface *locked) {
   return 0;
 }
 
-Video::Video(int width, int height, int rotation): rotation(rotation) {
+Video::Video(int width, int height, int rotation): rotation(rotation), screenLocked(false) {
   windowWidth = (rotation & 1) ? height : width;
   windowHeight = (rotation & 1) ? width : height;
   window = SDL_CreateWindow("Cornellbox", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
@@ -108,20 +109,50 @@ VideoSurface* Video::drawText(TTF_Font *font, const char *str, SDL_Color color)
   return new VideoSurface(this, textSurface, nullptr, w, h);
 }
 
-void Video::present() {
+int Video::lockScreen(LockedSurface *locked) {
+  if (!screenLocked) {
+    int result = screen->lock(&lockedScreen);
+    if (result < 0) return result;
+    screenLocked = true;
+  }
+  *locked = lockedScreen;
+  return 0;
+}
+
+void Video::present(VideoSurface *overlay, int x, int y) {
+  if (screenLocked) {
+    screen->unlock();
+    screenLocked = false;
+  }
   screen->update();
   SDL_RenderClear(renderer);
+  SDL_Rect dst {
+    .x = (windowWidth - screen->width) >> 1,
+    .y = (windowHeight - screen->height) >> 1,
+    .w = screen->width,
+    .h = screen->height,
+  };
   if (rotation) {
-    SDL_Rect dst {
-      .x = (windowWidth - screen->width) >> 1,
-      .y = (windowHeight - screen->height) >> 1,
-      .w = screen->width,
-      .h = screen->height,
-    };
     SDL_RenderCopyEx(renderer, screen->texture, nullptr, &dst, rotation * 90.0, nullptr, SDL_FLIP_NONE);
   } else {
     SDL_RenderCopy(renderer, screen->texture, nullptr, nullptr);
   }
+  if (overlay) {
+    // turned with the screen, around the screen's center
+    SDL_Texture *texture = SDL_CreateTextureFromSurface(renderer, overlay->surface);
+    SDL_Rect rect {
+      .x = dst.x + x,
+      .y = dst.y + y,
+      .w = overlay->width,
+      .h = overlay->height,
+    };
+    SDL_Point center {
+      .x = (screen->width >> 1) - x,
+      .y = (screen->height >> 1) - y,
+    };
+    SDL_RenderCopyEx(renderer, texture, nullptr, &rect, rotation * 90.0, &center, SDL_FLIP_NONE);
+    SDL_DestroyTexture(texture);
+  }
   SDL_RenderPresent(renderer);
 }
 
@@ -178,13 +209,29 @@ VideoSurface::~VideoSurface() {
   SDL_FreeSurface(surface);
 }
 
-Video::Video(int w, int h) {
+Video::Video(int w, int h): screenLocked(false), saved(nullptr), savedBytes(0) {
   screen = new VideoSurface(SDL_SetVideoMode(w, h, 32, 0));
 }
 
 Video::~Video() {
   delete screen;
   screen = nullptr;
+  delete[] saved;
+}
+
+int Video::lockScreen(LockedSurface *locked) {
+  if (!canLockScreen()) return -1;
+  // SDL counts the locks, one is kept until present()
+  if (!screenLocked) {
+    int result = SDL_LockSurface(screen->surface);
+    if (result) return result;
+    screenLocked = true;
+  }
+  locked->w = screen->surface->w;
+  locked->h = screen->surface->h;
+  locked->pitch = screen->surface->pitch;
+  locked->pixels = static_cast<uint8_t*>(screen->surface->pixels);
+  return 0;
 }
 
 VideoSurface* Video::createSurface(int w, int h) {
@@ -199,8 +246,34 @@ VideoSurface* Video::drawText(TTF_Font *font, const char *str, SDL_Color color)
   return new VideoSurface(TTF_RenderText_Blended(font, str, color));
 }
 
-void Video::present() {
-  SDL_Flip(screen->surface);
+void Video::present(VideoSurface *overlay, int x, int y) {
+  if (screenLocked) {
+    SDL_UnlockSurface(screen->surface);
+    screenLocked = false;
+  }
+  SDL_Surface *s = screen->surface;
+  // the rows under the overlay, which may be all there is of the picture
+  // if it was drawn on the screen directly
+  const int top = overlay && y > 0 ? y : 0;
+  const int bottom = overlay && y + overlay->surface->h < s->h ? y + overlay->surface->h : s->h;
+  const int bytes = overlay && bottom > top ? (bottom - top) * s->pitch : 0;
+  if (bytes) {
+    if (bytes > savedBytes) {
+      delete[] saved;
+      saved = new uint8_t[bytes];
+      savedBytes = bytes;
+    }
+    SDL_LockSurface(s);
+    memcpy(saved, static_cast<uint8_t*>(s->pixels) + top * s->pitch, bytes);
+    SDL_UnlockSurface(s);
+  }
+  if (overlay) overlay->blitOn(screen, x, y);
+  SDL_Flip(s);
+  if (bytes) {
+    SDL_LockSurface(s);
+    memcpy(static_cast<uint8_t*>(s->pixels) + top * s->pitch, saved, bytes);
+    SDL_UnlockSurface(s);
+  }
 }
 
 int keyCodeFromEvent(const SDL_Event &event) {
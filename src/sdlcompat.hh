@@ -46,6 +46,9 @@ class Video {
   SDL_Window *window;
   SDL_Renderer *renderer;
   VideoSurface *screen;
+  // the screen's surface is locked by lockScreen(), at lockedScreen
+  bool screenLocked;
+  LockedSurface lockedScreen;
 
   VideoSurface* createSurface(int w, int h, bool texture);
 public:
@@ -53,7 +56,17 @@ public:
   ~Video();
 
   inline VideoSurface* getScreen() { return screen; }
-  void present();
+  // Whether lockScreen() works, else draw on getScreen() or blit on it.
+  inline bool canLockScreen() const { return true; }
+  // The screen is ARGB8888, B, G, R, A in memory.
+  inline bool redFirst() const { return false; }
+  // getScreen()'s pixels, for drawing on directly until the next
+  // present(), which uploads them. They are ours, so they are kept from
+  // one lock to the next, unlike a streaming texture's.
+  int lockScreen(LockedSurface *locked);
+  // Shows the screen with overlay (if any) at x, y on top, without
+  // drawing it on the screen.
+  void present(VideoSurface *overlay = nullptr, int x = 0, int y = 0);
 
   inline VideoSurface* createSurface(int w, int h) {
     return createSurface(w, h, false);
@@ -90,12 +103,26 @@ public:
 
 class Video {
   VideoSurface *screen;
+  bool screenLocked;
+  // what an overlay covered, put back after present()
+  uint8_t *saved;
+  int savedBytes;
 public:
   Video(int width, int height);
   ~Video();
 
   inline VideoSurface* getScreen() { return screen; }
-  void present();
+  // Whether lockScreen() works, else draw on a surface and blit it on
+  // getScreen().
+  inline bool canLockScreen() const { return screen->surface->format->BytesPerPixel == 4; }
+  // Whether the screen's pixels are R, G, B, A in memory rather than B,
+  // G, R, A.
+  inline bool redFirst() const { return screen->surface->format->Rmask == 0xff; }
+  // The screen's pixels, for drawing on directly until the next present().
+  int lockScreen(LockedSurface *locked);
+  // Shows the screen with overlay (if any) at x, y on top, without
+  // leaving it on the screen.
+  void present(VideoSurface *overlay = nullptr, int x = 0, int y = 0);
 
   VideoSurface* createSurface(int w, int h);
   VideoSurface* drawText(TTF_Font *font, const char *str, SDL_Color color);
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+
+// The hash grid shared by IrradianceCache and PathGuide: a cell of space
+// and the dominant axis of the surface normal packed into a key, and
+// lock-free open addressing over a power of two table of entries that
+// start with that key. Only for their translation units, the kernels go
+// through the classes.
+
+// 20 bits per cell coordinate, 3 for the axis and extra bits, the lowest
+// bit keeps the key from being 0
+inline uint64_t cellKey(const float *p, const float *n, float invCellSize, int extraBits,
+    uint32_t extra) {
+  uint64_t key = 0;
+  for (int i = 0; i < 3; ++i) {
+    const int c = static_cast<int>(floorf(p[i] * invCellSize)) + (1 << 19);
+    key = key << 20 | (static_cast<uint64_t>(c) & 0xfffff);
+  }
+  const float ax = fabsf(n[0]), ay = fabsf(n[1]), az = fabsf(n[2]);
+  const int axis = ax >= ay && ax >= az ? 0 : ay >= az ? 1 : 2;
+  const int side = n[axis] < 0.0f;
+  key = key << 3 | (axis * 2 + side);
+  return (key << extraBits | extra) << 1 | 1;
+}
+
+// Entries for cells cut by surfaces, about 1.5 per cell of area, at a
+// load of 1/2, for copies keys per cell.
+inline uint32_t hashTableSize(float surfaceArea, float cellSize, int copies) {
+  const double cells = 3.0 * copies * surfaceArea / (cellSize * cellSize);
+  uint32_t size = 4096;
+  while (size < cells && size < (1U << 28)) size <<= 1;
+  return size;
+}
+
+// The entry of key, a new one if insert is set, null if there is none or
+// the table is too full. Entries are claimed with a CAS of their key.
+template<typename Entry>
+Entry* findEntry(Entry *entries, uint32_t mask, uint64_t key, bool insert) {
+  const int maxProbes = 16;
+  uint64_t h = key;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  uint32_t index = static_cast<uint32_t>(h) & mask;
+  for (int probe = 0; probe < maxProbes; ++probe, index = (index + 1) & mask) {
+    Entry *e = entries + index;
+    uint64_t k = __atomic_load_n(&e->key, __ATOMIC_ACQUIRE);
+    if (k == key) return e;
+    if (k) continue;
+    if (!insert) return nullptr;
+    // claim the empty entry, or find out who was faster and with what
+    if (__atomic_compare_exchange_n(&e->key, &k, key, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) ||
+        k == key)
+      return e;
+  }
+  return nullptr;
+}
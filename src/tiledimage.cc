@@ -0,0 +1,108 @@
+#define _FILE_OFFSET_BITS 64
+
+#include <string.h>
+#include <sys/types.h>
+
+#include "tiledimage.hh"
+
+namespace {
+
+const char magic[4] = { 'C', 'B', 'T', '1' };
+
+void put32(uint8_t *p, uint32_t v) {
+  for (int i = 0; i < 4; ++i)
+    p[i] = v >> (i * 8);
+}
+
+uint32_t get32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+}
+
+TiledImage::TiledImage(): file(nullptr), width(0), height(0), tileSize(0) { }
+
+TiledImage::~TiledImage() {
+  close();
+}
+
+bool TiledImage::create(const char *path, uint32_t width, uint32_t height, uint32_t tileSize) {
+  close();
+  if (!width || !height || !tileSize)
+    return false;
+  file = fopen(path, "w+b");
+  if (!file)
+    return false;
+  this->width = width;
+  this->height = height;
+  this->tileSize = tileSize;
+  uint8_t header[headerSize];
+  memcpy(header, magic, 4);
+  put32(header + 4, width);
+  put32(header + 8, height);
+  put32(header + 12, tileSize);
+  return fwrite(header, headerSize, 1, file) == 1;
+}
+
+bool TiledImage::open(const char *path) {
+  close();
+  file = fopen(path, "rb");
+  if (!file)
+    return false;
+  uint8_t header[headerSize];
+  if (fread(header, headerSize, 1, file) != 1 || memcmp(header, magic, 4)) {
+    close();
+    return false;
+  }
+  width = get32(header + 4);
+  height = get32(header + 8);
+  tileSize = get32(header + 12);
+  if (!width || !height || !tileSize) {
+    close();
+    return false;
+  }
+  return true;
+}
+
+void TiledImage::close() {
+  if (file) {
+    fclose(file);
+    file = nullptr;
+  }
+}
+
+// the bands above take tileSize full rows each, the tiles to the left in
+// the same band tileSize columns of the band's height each
+static off_t tileOffset(const TiledImage &image, uint32_t tx, uint32_t ty) {
+  const off_t tileSize = image.getTileSize();
+  return TiledImage::headerSize +
+      (ty * tileSize * image.getWidth() + tx * tileSize * image.tileHeight(ty)) * 3;
+}
+
+bool TiledImage::writeTile(uint32_t tx, uint32_t ty, const uint8_t *rgb) {
+  const size_t bytes = static_cast<size_t>(tileWidth(tx)) * tileHeight(ty) * 3;
+  return file && !fseeko(file, tileOffset(*this, tx, ty), SEEK_SET) &&
+      fwrite(rgb, 1, bytes, file) == bytes && !fflush(file);
+}
+
+bool TiledImage::readTile(uint32_t tx, uint32_t ty, uint8_t *rgb) {
+  const size_t bytes = static_cast<size_t>(tileWidth(tx)) * tileHeight(ty) * 3;
+  return file && !fseeko(file, tileOffset(*this, tx, ty), SEEK_SET) &&
+      fread(rgb, 1, bytes, file) == bytes;
+}
+
+bool TiledImage::readBand(uint32_t ty, uint8_t *rgb) {
+  if (!file || fseeko(file, tileOffset(*this, 0, ty), SEEK_SET))
+    return false;
+  const uint32_t th = tileHeight(ty);
+  // the band's tiles are stored back to back
+  for (uint32_t tx = 0; tx < tilesX(); ++tx) {
+    const size_t rowBytes = tileWidth(tx) * 3;
+    for (uint32_t y = 0; y < th; ++y) {
+      uint8_t *target = rgb + (static_cast<size_t>(y) * width + tx * tileSize) * 3;
+      if (fread(target, 1, rowBytes, file) != rowBytes)
+        return false;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+// A simple tiled 8-bit RGB raster for images too big to keep in memory.
+// After a 16 byte header ("CBT1", then width, height and tile size as
+// little endian uint32s) come the bands of tileSize rows, top to bottom.
+// Each band holds its tiles left to right, every tile as its own rows of
+// RGB pixels. The last column and the last band have the leftover sizes.
+// Every tile has a fixed offset, so they can be written in any order.
+class TiledImage {
+  FILE *file;
+  uint32_t width, height, tileSize;
+public:
+  static const int headerSize = 16;
+
+  TiledImage();
+  ~TiledImage();
+
+  // creates (or truncates) path, false if it can't
+  bool create(const char *path, uint32_t width, uint32_t height, uint32_t tileSize);
+  // false if path isn't a tiled image
+  bool open(const char *path);
+  void close();
+
+  inline uint32_t getWidth() const { return width; }
+  inline uint32_t getHeight() const { return height; }
+  inline uint32_t getTileSize() const { return tileSize; }
+  inline uint32_t tilesX() const { return (width + tileSize - 1) / tileSize; }
+  inline uint32_t tilesY() const { return (height + tileSize - 1) / tileSize; }
+  inline uint32_t tileWidth(uint32_t tx) const {
+    return tx + 1 < tilesX() ? tileSize : width - tx * tileSize;
+  }
+  inline uint32_t tileHeight(uint32_t ty) const {
+    return ty + 1 < tilesY() ? tileSize : height - ty * tileSize;
+  }
+
+  // rgb is tileWidth(tx) * tileHeight(ty) pixels
+  bool writeTile(uint32_t tx, uint32_t ty, const uint8_t *rgb);
+  bool readTile(uint32_t tx, uint32_t ty, uint8_t *rgb);
+
+  // Reads a whole band (tileHeight(ty) rows of the full width) into rgb as
+  // plain rows, tiles reassembled.
+  bool readBand(uint32_t ty, uint8_t *rgb);
+};
@@ -0,0 +1,240 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+#include "topology.hh"
+
+namespace {
+  const char *cpuRoot = "/sys/devices/system/cpu";
+  const char *nodeRoot = "/sys/devices/system/node";
+
+  // reads the first integer of a sysfs file, fallback if it isn't there
+  int readInt(const char *path, int fallback) {
+    FILE *f = fopen(path, "r");
+    if (!f) return fallback;
+    int value;
+    if (fscanf(f, "%d", &value) != 1) value = fallback;
+    fclose(f);
+    return value;
+  }
+
+  // parses a cpulist like "0-3,8,10-11" into a flag per CPU
+  bool readCpuList(const char *path, bool *flags, int max) {
+    FILE *f = fopen(path, "r");
+    if (!f) return false;
+    char line[1024];
+    bool ok = fgets(line, sizeof(line), f) != nullptr;
+    fclose(f);
+    if (!ok) return false;
+    memset(flags, 0, max * sizeof(bool));
+    for (char *p = line; *p && *p != '\n';) {
+      char *end;
+      int first = strtol(p, &end, 10);
+      if (end == p) return false;
+      int last = first;
+      p = end;
+      if (*p == '-') {
+        last = strtol(p + 1, &end, 10);
+        p = end;
+      }
+      for (int i = first; i <= last && i < max; ++i) {
+        if (i >= 0) flags[i] = true;
+      }
+      if (*p == ',') ++p;
+    }
+    return true;
+  }
+
+  // scores within this ratio of the class leader belong to its class,
+  // turbo bins of otherwise identical cores differ by a few percent
+  const float classTolerance = 0.9f;
+}
+
+CpuTopology::CpuTopology(): numCpus(0), numClasses(0), numNodes(1) {
+#ifdef __linux__
+  char path[256];
+  bool online[maxCpus];
+  snprintf(path, sizeof(path), "%s/online", cpuRoot);
+  if (!readCpuList(path, online, maxCpus)) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int i = 0; i < maxCpus; ++i) online[i] = i < n;
+  }
+  for (int i = 0; i < maxCpus; ++i) {
+    if (!online[i]) continue;
+    CpuInfo &cpu(cpus[numCpus++]);
+    cpu.id = i;
+    snprintf(path, sizeof(path), "%s/cpu%d/cpu_capacity", cpuRoot, i);
+    cpu.capacity = readInt(path, 0);
+    snprintf(path, sizeof(path), "%s/cpu%d/cpufreq/cpuinfo_max_freq", cpuRoot, i);
+    cpu.maxFreqKHz = readInt(path, 0);
+    cpu.coreClass = 0;
+    cpu.node = 0;
+  }
+  classify();
+  readNodes();
+#endif
+}
+
+// Kernels without NUMA support have no node directory, then everything
+// stays on node 0.
+void CpuTopology::readNodes() {
+  char path[256];
+  bool online[maxNodes];
+  snprintf(path, sizeof(path), "%s/online", nodeRoot);
+  if (!readCpuList(path, online, maxNodes)) return;
+  bool used[maxNodes];
+  memset(used, 0, sizeof(used));
+  for (int n = 0; n < maxNodes; ++n) {
+    bool nodeCpus[maxCpus];
+    snprintf(path, sizeof(path), "%s/node%d/cpulist", nodeRoot, n);
+    if (!online[n] || !readCpuList(path, nodeCpus, maxCpus)) continue;
+    for (int i = 0; i < numCpus; ++i) {
+      if (!nodeCpus[cpus[i].id]) continue;
+      cpus[i].node = n;
+      used[n] = true;
+    }
+  }
+  numNodes = 0;
+  for (int n = 0; n < maxNodes; ++n) {
+    if (used[n]) ++numNodes;
+  }
+  if (!numNodes) numNodes = 1;
+}
+
+void CpuTopology::classify() {
+  if (!numCpus) return;
+  // Intel hybrid parts list their P and E cores as separate PMUs, that's
+  // more reliable than the frequencies (E cores may turbo close to P cores)
+  bool performance[maxCpus], efficiency[maxCpus];
+  if (readCpuList("/sys/devices/cpu_core/cpus", performance, maxCpus) &&
+      readCpuList("/sys/devices/cpu_atom/cpus", efficiency, maxCpus)) {
+    for (int i = 0; i < numCpus; ++i) {
+      cpus[i].coreClass = performance[cpus[i].id] ? 0 : 1;
+    }
+    numClasses = 2;
+  } else {
+    bool haveCapacity = true, haveFreq = true;
+    for (int i = 0; i < numCpus; ++i) {
+      if (!cpus[i].capacity) haveCapacity = false;
+      if (!cpus[i].maxFreqKHz) haveFreq = false;
+    }
+    float scores[maxCpus];
+    for (int i = 0; i < numCpus; ++i) {
+      scores[i] = haveCapacity ? cpus[i].capacity : haveFreq ? cpus[i].maxFreqKHz : 1.0f;
+    }
+    // greedily peel off the fastest remaining class
+    bool assigned[maxCpus];
+    memset(assigned, 0, sizeof(assigned));
+    for (int left = numCpus; left > 0; ++numClasses) {
+      float best = 0.0f;
+      for (int i = 0; i < numCpus; ++i) {
+        if (!assigned[i] && scores[i] > best) best = scores[i];
+      }
+      for (int i = 0; i < numCpus; ++i) {
+        if (!assigned[i] && scores[i] >= best * classTolerance) {
+          assigned[i] = true;
+          cpus[i].coreClass = numClasses;
+          --left;
+        }
+      }
+    }
+  }
+  // stable sort by class so the fastest cores come first
+  for (int i = 1; i < numCpus; ++i) {
+    CpuInfo c = cpus[i];
+    int j = i;
+    for (; j > 0 && cpus[j - 1].coreClass > c.coreClass; --j) {
+      cpus[j] = cpus[j - 1];
+    }
+    cpus[j] = c;
+  }
+}
+
+int CpuTopology::select(int *cpuIds, int max, bool performanceOnly) const {
+  int n = 0;
+  for (int i = 0; i < numCpus && n < max; ++i) {
+    if (performanceOnly && cpus[i].coreClass > 0) break;
+    cpuIds[n++] = cpus[i].id;
+  }
+  return n;
+}
+
+float CpuTopology::relativeSpeed(int cpuId) const {
+  const CpuInfo *fastest = numCpus ? &cpus[0] : nullptr;
+  for (int i = 0; i < numCpus; ++i) {
+    if (cpus[i].id != cpuId) continue;
+    if (cpus[i].capacity && fastest->capacity)
+      return static_cast<float>(cpus[i].capacity) / fastest->capacity;
+    if (cpus[i].maxFreqKHz && fastest->maxFreqKHz)
+      return static_cast<float>(cpus[i].maxFreqKHz) / fastest->maxFreqKHz;
+    break;
+  }
+  return 1.0f;
+}
+
+int CpuTopology::nodeOf(int cpuId) const {
+  for (int i = 0; i < numCpus; ++i) {
+    if (cpus[i].id == cpuId) return cpus[i].node;
+  }
+  return 0;
+}
+
+void CpuTopology::dump(FILE *f) const {
+  for (int c = 0; c < numClasses; ++c) {
+    int n = 0;
+    const CpuInfo *first = nullptr;
+    for (int i = 0; i < numCpus; ++i) {
+      if (cpus[i].coreClass != c) continue;
+      if (!first) first = &cpus[i];
+      ++n;
+    }
+    if (!first) continue;
+    fprintf(f, "Core class %d: %d cpu(s), capacity %d, max %.2f GHz\n",
+        c, n, first->capacity, first->maxFreqKHz * 1e-6);
+  }
+  if (numNodes < 2) return;
+  for (int node = 0; node < maxNodes; ++node) {
+    int n = 0;
+    for (int i = 0; i < numCpus; ++i) {
+      if (cpus[i].node == node) ++n;
+    }
+    if (n) fprintf(f, "NUMA node %d: %d cpu(s)\n", node, n);
+  }
+}
+
+bool pinThread(pthread_t thread, int cpuId) {
+#ifdef __linux__
+  if (cpuId < 0 || cpuId >= CPU_SETSIZE) return false;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpuId, &set);
+  return !pthread_setaffinity_np(thread, sizeof(set), &set);
+#else
+  return false;
+#endif
+}
+
+bool bindToNode(void *memory, size_t bytes, int node) {
+#if defined(__linux__) && defined(SYS_mbind)
+  // from linux/mempolicy.h, to not depend on libnuma's headers
+  const int preferred = 1; // MPOL_PREFERRED
+  const unsigned moveOwnPages = 2; // MPOL_MF_MOVE
+  if (node < 0 || node >= CpuTopology::maxNodes) return false;
+  const uintptr_t page = sysconf(_SC_PAGESIZE);
+  const uintptr_t begin = (reinterpret_cast<uintptr_t>(memory) + page - 1) & ~(page - 1);
+  const uintptr_t end = (reinterpret_cast<uintptr_t>(memory) + bytes) & ~(page - 1);
+  if (end <= begin) return true;
+  unsigned long mask[CpuTopology::maxNodes / (8 * sizeof(unsigned long))] = { };
+  mask[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+  // the kernel reads maxnode - 1 bits
+  return !syscall(SYS_mbind, begin, end - begin, preferred, mask,
+      CpuTopology::maxNodes + 1, moveOwnPages);
+#else
+  return false;
+#endif
+}
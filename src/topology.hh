@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdio.h>
+#include <pthread.h>
+
+struct CpuInfo {
+  int id;
+  // relative performance from the kernel (arm64 and recent x86), 0 if unknown
+  int capacity;
+  // cpuinfo_max_freq, 0 if unknown
+  int maxFreqKHz;
+  // 0 is the fastest class
+  int coreClass;
+  // NUMA node, 0 without NUMA
+  int node;
+};
+
+// The online CPUs grouped into classes of similar speed, fastest first.
+// Big.LITTLE and hybrid x86 parts report the classes through
+// cpu_capacity, the cpu_core/cpu_atom PMUs or at least differing maximum
+// frequencies in sysfs. Without any of those all CPUs are one class.
+class CpuTopology {
+public:
+  static const int maxCpus = 256;
+  static const int maxNodes = 64;
+private:
+  CpuInfo cpus[maxCpus];
+  int numCpus;
+  int numClasses;
+  int numNodes;
+
+  void classify();
+  void readNodes();
+public:
+  CpuTopology();
+
+  inline int count() const { return numCpus; }
+  inline int classes() const { return numClasses; }
+  // NUMA nodes with online CPUs, 1 without NUMA
+  inline int nodes() const { return numNodes; }
+  inline const CpuInfo& operator[](int index) const { return cpus[index]; }
+
+  // CPUs ordered fastest first, optionally just the fastest class
+  int select(int *cpuIds, int max, bool performanceOnly) const;
+  // speed of the CPU relative to the fastest one, 1 if unknown
+  float relativeSpeed(int cpuId) const;
+  // NUMA node of the CPU, 0 if unknown
+  int nodeOf(int cpuId) const;
+  void dump(FILE *f) const;
+};
+
+bool pinThread(pthread_t thread, int cpuId);
+
+// Moves the whole pages of memory to the NUMA node and keeps them there
+// when they are touched later, the partial pages at the ends stay where
+// they are. The node is preferred, not required, so allocations don't fail
+// if it runs out of memory.
+bool bindToNode(void *memory, size_t bytes, int node);
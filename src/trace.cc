@@ -0,0 +1,90 @@
+#ifdef TRACE_EVENTS
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "trace.hh"
+
+namespace {
+  const int maxThreads = 256;
+  // spans per thread, a power of two
+  const uint32_t capacity = 1 << 16;
+
+  struct Span {
+    const char *name;
+    uint64_t start, end;
+  };
+
+  struct TraceBuffer {
+    Span *spans;
+    // total spans recorded, only the owning thread writes it
+    uint64_t head;
+    char name[32];
+  };
+
+  TraceBuffer buffers[maxThreads];
+  uint64_t origin = traceClock();
+
+  thread_local TraceBuffer *current = nullptr;
+}
+
+uint64_t traceClock() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void attachTraceBuffer(int thread, const char *name) {
+  if (thread < 0 || thread >= maxThreads) return;
+  TraceBuffer &b(buffers[thread]);
+  if (!b.spans) b.spans = new Span[capacity];
+  snprintf(b.name, sizeof(b.name), "%s", name);
+  current = &b;
+}
+
+void recordTraceSpan(const char *name, uint64_t start, uint64_t end) {
+  TraceBuffer *b = current;
+  if (!b) return;
+  uint64_t head = b->head;
+  Span &s(b->spans[head & (capacity - 1)]);
+  s.name = name;
+  s.start = start;
+  s.end = end;
+  // publish the span after it's written
+  __atomic_store_n(&b->head, head + 1, __ATOMIC_RELEASE);
+}
+
+bool writeTrace(const char *path) {
+  FILE *f = fopen(path, "w");
+  if (!f) {
+    perror(path);
+    return false;
+  }
+  fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  bool first = true;
+  for (int t = 0; t < maxThreads; ++t) {
+    TraceBuffer &b(buffers[t]);
+    if (!b.spans) continue;
+    uint64_t head = __atomic_load_n(&b.head, __ATOMIC_ACQUIRE);
+    uint64_t tail = head > capacity ? head - capacity : 0;
+    fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+        first ? "" : ",\n", t, b.name);
+    fprintf(f, ",\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"sort_index\":%d}}", t, t);
+    first = false;
+    if (tail) {
+      fprintf(stderr, "Trace of %s lost its first %llu spans\n", b.name, (unsigned long long) tail);
+    }
+    for (uint64_t i = tail; i < head; ++i) {
+      const Span &s(b.spans[i & (capacity - 1)]);
+      // microseconds with nanosecond precision
+      fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+          s.name, t, (s.start - origin) * 1e-3, (s.end - s.start) * 1e-3);
+    }
+  }
+  fprintf(f, "\n]}\n");
+  fclose(f);
+  return true;
+}
+
+#endif
@@ -0,0 +1,36 @@
+#pragma once
+
+// Timeline of what each thread was doing, compiled in with -DTRACE_EVENTS
+// and written as Chrome trace events (chrome://tracing, ui.perfetto.dev).
+// Every thread records into its own ring buffer, so recording takes no
+// locks; when a buffer is full the oldest spans are overwritten.
+
+#ifdef TRACE_EVENTS
+
+#include <stdint.h>
+
+uint64_t traceClock();
+
+// gives the calling thread a buffer, the name shows up in the viewer
+void attachTraceBuffer(int thread, const char *name);
+void recordTraceSpan(const char *name, uint64_t start, uint64_t end);
+bool writeTrace(const char *path);
+
+class TraceScope {
+  const char *name;
+  uint64_t start;
+public:
+  // name must be a string literal or otherwise outlive the trace
+  TraceScope(const char *name): name(name), start(traceClock()) { }
+  ~TraceScope() { recordTraceSpan(name, start, traceClock()); }
+};
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+
+#else
+
+#define TRACE_SCOPE(name) ((void) 0)
+
+#endif
@@ -0,0 +1,191 @@
+// The compact accumulator formats against the float one, with the bounds
+// at the top of accumulator.hh, and their conversions.
+
+#include "../src/accumulator.hh"
+
+#include "check.hh"
+#include <stdlib.h>
+
+namespace {
+
+const int side = 64;
+const int samplesPerPixel = 1024;
+
+// the display level tonemap() gives channel c of rgb
+int level(const float *rgb, int c) {
+  uint8_t pixel[4];
+  tonemap(rgb, pixel);
+  return pixel[c];
+}
+
+int testHalfConversions() {
+  int failures = 0;
+  // every finite half comes back as itself, whatever the dither
+  for (uint32_t h = 0; h <= 0x7bff; ++h) {
+    const float f = floatFromHalf(h);
+    CHECK(failures, halfFromFloat(f, 0) == h && halfFromFloat(f, ~0U) == h,
+        "half %04x (%g) comes back as %04x, %04x", h, f, halfFromFloat(f, 0), halfFromFloat(f, ~0U));
+  }
+  // the edges: the largest half, clamping, nothing below 0 and NaN
+  CHECK(failures, floatFromHalf(0x7bff) == 65504.0f, "the largest half is %g", floatFromHalf(0x7bff));
+  CHECK(failures, halfFromFloat(65536.0f, 0) == 0x7bff && halfFromFloat(1e30f, ~0U) == 0x7bff,
+      "large values don't clamp");
+  CHECK(failures, halfFromFloat(65520.0f, ~0U) == 0x7bff, "rounding up past 65504 doesn't clamp");
+  CHECK(failures, halfFromFloat(-1.0f, ~0U) == 0 && halfFromFloat(NAN, ~0U) == 0,
+      "negatives or NaN aren't 0");
+  CHECK(failures, floatFromHalf(1) == ldexpf(1.0f, -24) && floatFromHalf(0x400) == ldexpf(1.0f, -14),
+      "the subnormal steps are off");
+  // a random store is one of the two neighbouring halves, and unbiased
+  TestRandom random(35);
+  for (int round = 0; round < 2000; ++round) {
+    const float f = ldexpf(random.range(1.0f, 2.0f), static_cast<int>(random.next() % 40) - 28);
+    const uint16_t down = halfFromFloat(f, 0);
+    double sum = 0.0;
+    const int stores = 4000;
+    for (int i = 0; i < stores; ++i) {
+      const uint16_t h = halfFromFloat(f, random.next());
+      CHECK(failures, h == down || h == down + 1, "%g stored as %04x, not %04x or the next", f, h, down);
+      sum += floatFromHalf(h);
+    }
+    const double step = floatFromHalf(down + 1) - floatFromHalf(down);
+    // the mean of the stores has a deviation of at most step / 2 / sqrt(stores)
+    CHECK(failures, fabs(sum / stores - f) <= 5.0 * 0.5 * step / sqrt(stores),
+        "%g stores to %g on average", f, sum / stores);
+  }
+  return failures;
+}
+
+int testRgb9e5Conversions() {
+  int failures = 0;
+  TestRandom random(9);
+  // every code with a mantissa over 255 somewhere comes back as itself,
+  // the others as the same values with a smaller exponent
+  for (int round = 0; round < 200000; ++round) {
+    const uint32_t exponent = random.next() % 32;
+    uint32_t code = (exponent << 27) | (random.next() & 0x7ffffff);
+    float rgb[3], back[3];
+    floatsFromRgb9e5(code, rgb);
+    floatsFromRgb9e5(rgb9e5FromFloats(rgb, random.next()), back);
+    CHECK(failures, rgb[0] == back[0] && rgb[1] == back[1] && rgb[2] == back[2],
+        "%08x (%g %g %g) comes back as %g %g %g", code, rgb[0], rgb[1], rgb[2], back[0], back[1], back[2]);
+  }
+  // the edges: the subnormal end, clamping, nothing below 0 and NaN
+  const float tiny[3] = { ldexpf(1.0f, -24), ldexpf(3.0f, -24), 0.0f };
+  float back[3];
+  floatsFromRgb9e5(rgb9e5FromFloats(tiny, 0), back);
+  CHECK(failures, back[0] == tiny[0] && back[1] == tiny[1] && back[2] == 0.0f,
+      "the smallest steps come back as %g %g %g", back[0], back[1], back[2]);
+  const float huge[3] = { 1e30f, 65408.0f, 70000.0f };
+  floatsFromRgb9e5(rgb9e5FromFloats(huge, ~0U), back);
+  CHECK(failures, back[0] == 65408.0f && back[1] == 65408.0f && back[2] == 65408.0f,
+      "large values clamp to %g %g %g", back[0], back[1], back[2]);
+  const float bad[3] = { -1.0f, NAN, 0.5f };
+  floatsFromRgb9e5(rgb9e5FromFloats(bad, ~0U), back);
+  CHECK(failures, back[0] == 0.0f && back[1] == 0.0f && back[2] == 0.5f,
+      "negatives or NaN come back as %g %g", back[0], back[1]);
+  // a random store is within a step, 2^-8 of the largest channel or 2^-24
+  // near black, and unbiased
+  for (int round = 0; round < 2000; ++round) {
+    float rgb[3];
+    const float top = ldexpf(random.range(1.0f, 2.0f), static_cast<int>(random.next() % 30) - 20);
+    const float step = fmaxf(ldexpf(top, -8), ldexpf(1.0f, -24));
+    for (int i = 0; i < 3; ++i)
+      rgb[i] = top * (i ? random.uniform() : 1.0f);
+    double sums[3] = { };
+    const int stores = 4000;
+    for (int j = 0; j < stores; ++j) {
+      floatsFromRgb9e5(rgb9e5FromFloats(rgb, random.next()), back);
+      for (int i = 0; i < 3; ++i) {
+        CHECK(failures, fabsf(back[i] - rgb[i]) <= step,
+            "channel %d of %g %g %g stored as %g", i, rgb[0], rgb[1], rgb[2], back[i]);
+        sums[i] += back[i];
+      }
+    }
+    for (int i = 0; i < 3; ++i) {
+      CHECK(failures, fabs(sums[i] / stores - rgb[i]) <= 5.0 * 0.5 * step / sqrt(stores),
+          "channel %d of %g %g %g stores to %g on average", i, rgb[0], rgb[1], rgb[2], sums[i] / stores);
+    }
+  }
+  return failures;
+}
+
+// The same sample streams through the three formats: side x side pixels
+// of 1024 samples in passes of 1 to 16, like the scheduler makes them.
+// Each pixel's brightest channel has a mean from 1/64 to 16, the others
+// down to 4 times less, the samples are exponentially distributed around
+// them.
+int testFormats() {
+  int failures = 0;
+  Accumulator floats(side, side, ACCUMULATE_FLOAT);
+  Accumulator halves(side, side, ACCUMULATE_HALF);
+  Accumulator shared(side, side, ACCUMULATE_RGB9E5);
+  Accumulator *formats[] = { &floats, &halves, &shared };
+  TestRandom random(1024);
+  float means[side * side][3];
+  for (auto &m : means) {
+    const float top = ldexpf(1.0f, -6) * powf(1024.0f, random.uniform());
+    for (float &c : m)
+      c = top / powf(4.0f, random.uniform());
+  }
+  uint8_t pixel[4];
+  for (int done = 0; done < samplesPerPixel; ) {
+    int pass = 1 + random.next() % 16;
+    if (done + pass > samplesPerPixel) pass = samplesPerPixel - done;
+    for (int p = 0; p < side * side; ++p) {
+      float sum[3] = { };
+      for (int s = 0; s < pass; ++s) {
+        for (int i = 0; i < 3; ++i)
+          sum[i] += means[p][i] * -logf(1.0f - random.uniform());
+      }
+      for (Accumulator *a : formats)
+        a->add(p % side, p / side, sum, pass, 1, pixel);
+    }
+    done += pass;
+  }
+  double worstHalf = 0.0, worstShared = 0.0, worstOwn = 0.0;
+  double biasHalf = 0.0, biasShared = 0.0;
+  int worstLevelHalf = 0, worstLevelShared = 0;
+  for (int p = 0; p < side * side; ++p) {
+    const int x = p % side, y = p / side;
+    float exact[3], half[3], rgb9e5[3];
+    floats.mean(x, y, exact);
+    halves.mean(x, y, half);
+    shared.mean(x, y, rgb9e5);
+    CHECK(failures, halves.samples(x, y) == samplesPerPixel && shared.samples(x, y) == samplesPerPixel,
+        "pixel %d has %d and %d samples", p, halves.samples(x, y), shared.samples(x, y));
+    const float top = fmaxf(exact[0], fmaxf(exact[1], exact[2]));
+    for (int i = 0; i < 3; ++i) {
+      const double halfError = (half[i] - exact[i]) / exact[i];
+      const double sharedError = (rgb9e5[i] - exact[i]) / top;
+      if (exact[i] >= 1.0f / 64.0f) worstHalf = fmax(worstHalf, fabs(halfError));
+      worstShared = fmax(worstShared, fabs(sharedError));
+      // relative to itself too, the channels are within 4 times of each other
+      worstOwn = fmax(worstOwn, fabs((rgb9e5[i] - exact[i]) / exact[i]));
+      biasHalf += halfError;
+      biasShared += sharedError;
+      worstLevelHalf = abs(level(half, i) - level(exact, i)) > worstLevelHalf ?
+          abs(level(half, i) - level(exact, i)) : worstLevelHalf;
+      worstLevelShared = abs(level(rgb9e5, i) - level(exact, i)) > worstLevelShared ?
+          abs(level(rgb9e5, i) - level(exact, i)) : worstLevelShared;
+    }
+  }
+  const int channels = side * side * 3;
+  printf("  half %.2f%% %d levels, rgb9e5 %.2f%% (own %.2f%%) %d levels, bias %.1e %.1e\n",
+      worstHalf * 100.0, worstLevelHalf, worstShared * 100.0, worstOwn * 100.0, worstLevelShared,
+      biasHalf / channels, biasShared / channels);
+  CHECK(failures, worstHalf <= 0.01, "half is %.2f%% off", worstHalf * 100.0);
+  CHECK(failures, worstLevelHalf <= 1, "half is %d display levels off", worstLevelHalf);
+  CHECK(failures, worstShared <= 0.04, "rgb9e5 is %.2f%% of the brightest channel off", worstShared * 100.0);
+  CHECK(failures, worstOwn <= 0.08, "an rgb9e5 channel is %.2f%% of itself off", worstOwn * 100.0);
+  CHECK(failures, worstLevelShared <= 4, "rgb9e5 is %d display levels off", worstLevelShared);
+  // no bias: the errors average out over the pixels
+  CHECK(failures, fabs(biasHalf / channels) <= 2e-4, "half is %.1e off on average", biasHalf / channels);
+  CHECK(failures, fabs(biasShared / channels) <= 5e-4, "rgb9e5 is %.1e off on average", biasShared / channels);
+  return failures;
+}
+
+}
+
+int accumulatorTests() {
+  return testHalfConversions() + testRgb9e5Conversions() + testFormats();
+}
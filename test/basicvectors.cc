@@ -0,0 +1,34 @@
+// The plain array Vec, whatever this build's Vec is. platform.hh is only
+// read inside the namespace, so the two don't clash; fastmath.hh (and with
+// it rsqrt()) is the same for both.
+
+#define BASIC_VECTORS
+#include "../src/fastmath.hh"
+
+namespace basic {
+#include "../src/platform.hh"
+}
+
+#include "basicvectors.hh"
+
+void basicDivide(const float *a, const float *b, float *out) {
+  (basic::Vec(a) / basic::Vec(b)).flatten(out);
+}
+
+void basicSqrt(const float *a, float *out) {
+  basic::Vec(a).sqrt().flatten(out);
+}
+
+float basicDot(const float *a, const float *b) {
+  return basic::Vec(a) | basic::Vec(b);
+}
+
+float basicLength(const float *a) {
+  return basic::Vec(a).length();
+}
+
+void basicNormalize(const float *a, float *out) {
+  basic::Vec v(a);
+  v.normalize();
+  v.flatten(out);
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+// What the BASIC_VECTORS Vec gives, from a copy of it in a namespace of its
+// own (basicvectors.cc), to hold the build's Vec against. Vectors are 4
+// floats.
+void basicDivide(const float *a, const float *b, float *out);
+void basicSqrt(const float *a, float *out);
+float basicDot(const float *a, const float *b);
+float basicLength(const float *a);
+void basicNormalize(const float *a, float *out);
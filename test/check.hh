@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+// The checks of build/cornellbox_test (make test). Every test file has a
+// function that runs its checks and returns how many failed, see main.cc.
+// CHECK prints the failed ones with a printf style message.
+#define CHECK(failures, condition, ...) \
+  do { \
+    if (!(condition)) { \
+      ++(failures); \
+      fprintf(stderr, "%s:%d: %s: ", __FILE__, __LINE__, #condition); \
+      fprintf(stderr, __VA_ARGS__); \
+      fprintf(stderr, "\n"); \
+    } \
+  } while (0)
+
+// ulps between two finite floats of the same sign, as a distance along the
+// float line
+inline double ulpDistance(float a, float b) {
+  if (a == b) return 0.0;
+  int32_t i, j;
+  memcpy(&i, &a, sizeof(i));
+  memcpy(&j, &b, sizeof(j));
+  if (i < 0) i = INT32_MIN - i;
+  if (j < 0) j = INT32_MIN - j;
+  return fabs(static_cast<double>(i) - static_cast<double>(j));
+}
+
+// the ulp of a float near x, for errors against double results
+inline double ulpOf(double x) {
+  int e;
+  frexp(fabs(x), &e);
+  if (e < -125) e = -125;
+  return ldexp(1.0, e - 24);
+}
+
+// a small deterministic generator, so failures repeat
+struct TestRandom {
+  uint64_t state;
+  explicit TestRandom(uint64_t seed): state(seed * 0x9e3779b97f4a7c15ULL + 1) { }
+  inline uint32_t next() {
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return static_cast<uint32_t>(state >> 32);
+  }
+  // uniform in [0, 1)
+  inline float uniform() {
+    return (next() >> 8) * (1.0f / 16777216.0f);
+  }
+  inline float range(float lo, float hi) {
+    return lo + (hi - lo) * uniform();
+  }
+};
+
+int vectorTests();
+int accumulatorTests();
+int fastMathTests();
@@ -0,0 +1,162 @@
+// The fastmath.hh functions against double precision libm, within the
+// maxima in the table at the top of the header. The ranges are swept
+// through their float bit patterns with a stride, so every exponent and a
+// spread of mantissas is covered.
+
+#include "../src/fastmath.hh"
+
+#include "check.hh"
+
+namespace {
+
+// the floats from lo to hi with every stride-th bit pattern, both > 0
+template<typename F>
+void sweep(float lo, float hi, uint32_t stride, F f) {
+  uint32_t i, end;
+  memcpy(&i, &lo, sizeof(i));
+  memcpy(&end, &hi, sizeof(end));
+  for (; i <= end; i += stride) {
+    float x;
+    memcpy(&x, &i, sizeof(x));
+    f(x);
+  }
+}
+
+#if defined(__SSE__)
+const double rsqrtUlps = 4.0;
+#else
+const double rsqrtUlps = 2.2;
+#endif
+
+int testRsqrt() {
+  int failures = 0;
+  double worst = 0.0;
+  sweep(ldexpf(1.0f, -20), ldexpf(1.0f, 20), 37, [&](float x) {
+    const double exact = 1.0 / sqrt(static_cast<double>(x));
+    const double error = fabs(rsqrt(x) - exact) / ulpOf(exact);
+    if (error > worst) worst = error;
+    CHECK(failures, error <= rsqrtUlps, "rsqrt(%a) is %a, %.2f ulp off", x, rsqrt(x), error);
+  });
+  printf("  rsqrt %.2f ulp\n", worst);
+  return failures;
+}
+
+int testSinCosQuarter() {
+  int failures = 0;
+  double worstSin = 0.0, worstCos = 0.0;
+  const float quarter = static_cast<float>(M_PI / 4.0);
+  // from the smallest normal, sin(x) is x below that
+  sweep(ldexpf(1.0f, -126), quarter, 101, [&](float x) {
+    const float both[2] = { x, -x };
+    for (const float y : both) {
+      float s, c;
+      sinCosQuarter(y, s, c);
+      const double sinError = fabs(s - sin(static_cast<double>(y))) / ulpOf(sin(static_cast<double>(y)));
+      const double cosError = fabs(c - cos(static_cast<double>(y))) / ulpOf(cos(static_cast<double>(y)));
+      if (sinError > worstSin) worstSin = sinError;
+      if (cosError > worstCos) worstCos = cosError;
+      CHECK(failures, sinError <= 0.8 && cosError <= 1.3,
+          "sinCosQuarter(%a) is %a %a, %.2f and %.2f ulp off", y, s, c, sinError, cosError);
+    }
+  });
+  printf("  sinCosQuarter %.2f ulp for sin, %.2f for cos\n", worstSin, worstCos);
+  return failures;
+}
+
+// within 1.6 ulp, or 2^-26 absolute below 1/8
+double sinCosError(float result, double exact, bool &ok) {
+  const double error = fabs(result - exact);
+  ok = error <= 1.6 * ulpOf(exact) || (fabs(exact) < 0.125 && error <= ldexp(1.0, -26));
+  return error / ulpOf(exact);
+}
+
+int testSinCos() {
+  int failures = 0;
+  double worst = 0.0;
+  sweep(ldexpf(1.0f, -126), 8192.0f, 211, [&](float x) {
+    const float both[2] = { x, -x };
+    for (const float y : both) {
+      float s, c;
+      sinCos(y, s, c);
+      bool sinOk, cosOk;
+      const double sinError = sinCosError(s, sin(static_cast<double>(y)), sinOk);
+      const double cosError = sinCosError(c, cos(static_cast<double>(y)), cosOk);
+      if (fabs(s) >= 0.125f && sinError > worst) worst = sinError;
+      if (fabs(c) >= 0.125f && cosError > worst) worst = cosError;
+      CHECK(failures, sinOk && cosOk, "sinCos(%a) is %a %a, %.2f and %.2f ulp off", y, s, c, sinError, cosError);
+    }
+  });
+  // the array version is the same
+  float x[64], s[64], c[64];
+  TestRandom random(39);
+  for (float &v : x)
+    v = random.range(-8192.0f, 8192.0f);
+  sinCos(x, s, c, 64);
+  for (int i = 0; i < 64; ++i) {
+    float s1, c1;
+    sinCos(x[i], s1, c1);
+    CHECK(failures, s[i] == s1 && c[i] == c1, "sinCos of an array differs at %a", x[i]);
+  }
+  printf("  sinCos %.2f ulp\n", worst);
+  return failures;
+}
+
+// Shirley and Chiu's mapping in double
+void exactDisk(float u, float v, double &x, double &y) {
+  const double a = 2.0 * u - 1.0, b = 2.0 * v - 1.0;
+  if (a == 0.0 && b == 0.0) {
+    x = y = 0.0;
+  } else if (fabs(a) > fabs(b)) {
+    x = a * cos(M_PI / 4.0 * b / a);
+    y = a * sin(M_PI / 4.0 * b / a);
+  } else {
+    x = b * sin(M_PI / 4.0 * a / b);
+    y = b * cos(M_PI / 4.0 * a / b);
+  }
+}
+
+int testDiskAndHemisphere() {
+  int failures = 0;
+  double worstDisk = 0.0, worstLength = 0.0;
+  const int steps = 1024;
+  for (int i = 0; i <= steps; ++i) {
+    for (int j = 0; j <= steps; ++j) {
+      // the grid, and the largest floats below 1 on its far edges
+      const float u = i < steps ? static_cast<float>(i) / steps : nextafterf(1.0f, 0.0f);
+      const float v = j < steps ? static_cast<float>(j) / steps : nextafterf(1.0f, 0.0f);
+      float x, y, z;
+      double ex, ey;
+      concentricDisk(u, v, x, y);
+      exactDisk(u, v, ex, ey);
+      const double error = fmax(fabs(x - ex), fabs(y - ey));
+      if (error > worstDisk) worstDisk = error;
+      CHECK(failures, error <= 2e-7, "concentricDisk(%g, %g) is %g %g, not %g %g", u, v, x, y, ex, ey);
+      cosineHemisphere(u, v, x, y, z);
+      const double length = fabs(sqrt(static_cast<double>(x) * x + static_cast<double>(y) * y +
+          static_cast<double>(z) * z) - 1.0);
+      if (length > worstLength) worstLength = length;
+      CHECK(failures, z >= 0.0f && length <= 2e-7, "cosineHemisphere(%g, %g) is %g %g %g", u, v, x, y, z);
+    }
+  }
+  // the array version is the same
+  float u[64], v[64], x[64], y[64], z[64];
+  TestRandom random(139);
+  for (int i = 0; i < 64; ++i) {
+    u[i] = random.uniform();
+    v[i] = random.uniform();
+  }
+  cosineHemisphere(u, v, x, y, z, 64);
+  for (int i = 0; i < 64; ++i) {
+    float x1, y1, z1;
+    cosineHemisphere(u[i], v[i], x1, y1, z1);
+    CHECK(failures, x[i] == x1 && y[i] == y1 && z[i] == z1, "cosineHemisphere of an array differs at %g %g", u[i], v[i]);
+  }
+  printf("  concentricDisk %.2e, cosineHemisphere %.2e off unit length\n", worstDisk, worstLength);
+  return failures;
+}
+
+}
+
+int fastMathTests() {
+  return testRsqrt() + testSinCosQuarter() + testSinCos() + testDiskAndHemisphere();
+}
@@ -0,0 +1,32 @@
+// make test: runs every test file's checks, exits with 1 if any failed.
+
+#include <stdio.h>
+
+#include "check.hh"
+
+namespace {
+
+struct Test {
+  const char *name;
+  int (*run)();
+};
+
+const Test tests[] = {
+  { "vectors", vectorTests },
+  { "accumulator", accumulatorTests },
+  { "fastmath", fastMathTests },
+};
+
+}
+
+int main() {
+  int failed = 0;
+  for (const Test &test : tests) {
+    const int failures = test.run();
+    printf("%-12s %s", test.name, failures ? "FAILED" : "ok");
+    if (failures) printf(" (%d checks)", failures);
+    printf("\n");
+    failed += failures;
+  }
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,105 @@
+// This build's Vec (SSE, NEON or plain) against the BASIC_VECTORS one,
+// within the bounds at the top of platform.hh.
+
+#include "../src/platform.hh"
+
+#include "check.hh"
+#include "basicvectors.hh"
+
+namespace {
+
+const int rounds = 100000;
+
+Vec toVec(const float *f) {
+  return Vec(f[0], f[1], f[2]);
+}
+
+// x, y, z with sizes from 2^-10 to 2^10 and either sign, w = 0
+void randomVector(TestRandom &random, float *f, bool positive = false) {
+  for (int i = 0; i < 3; ++i) {
+    const float size = ldexpf(random.range(1.0f, 2.0f), static_cast<int>(random.next() % 21) - 10);
+    f[i] = positive || random.next() & 1 ? size : -size;
+  }
+  f[3] = 0.0f;
+}
+
+// the bound on | of a and b: the lanes summed in another order
+float dotTolerance(const float *a, const float *b) {
+  float sum = 0.0f;
+  for (int i = 0; i < 4; ++i)
+    sum += fabsf(a[i] * b[i]);
+  return ldexpf(sum, -21);
+}
+
+}
+
+int vectorTests() {
+  int failures = 0;
+  TestRandom random(34);
+  double worstDivide = 0.0, worstSqrt = 0.0, worstNormalize = 0.0, worstLength = 0.0;
+  for (int round = 0; round < rounds; ++round) {
+    float a[4], b[4], expected[4], got[4];
+    randomVector(random, a);
+    randomVector(random, b);
+
+    basicDivide(a, b, expected);
+    (toVec(a) / toVec(b)).flatten(got);
+    for (int i = 0; i < 3; ++i)
+      worstDivide = fmax(worstDivide, ulpDistance(got[i], expected[i]));
+
+    float positive[4];
+    randomVector(random, positive, true);
+    basicSqrt(positive, expected);
+    toVec(positive).sqrt().flatten(got);
+    for (int i = 0; i < 3; ++i)
+      worstSqrt = fmax(worstSqrt, ulpDistance(got[i], expected[i]));
+    // sqrt(0) stays 0 rather than 0 * inf
+    Vec(0.0f).sqrt().flatten(got);
+    CHECK(failures, got[0] == 0.0f && got[3] == 0.0f, "sqrt(0) is %g", got[0]);
+
+    const float dot = toVec(a) | toVec(b);
+    const float basicResult = basicDot(a, b);
+    CHECK(failures, fabsf(dot - basicResult) <= dotTolerance(a, b),
+        "a | b is %.9g, %.9g with BASIC_VECTORS", dot, basicResult);
+
+    basicNormalize(a, expected);
+    Vec n(toVec(a));
+    n.normalize();
+    n.flatten(got);
+    for (int i = 0; i < 3; ++i)
+      worstNormalize = fmax(worstNormalize, fabs(got[i] - expected[i]) / ldexp(1.0, -23));
+    (!toVec(a)).flatten(got);
+    for (int i = 0; i < 3; ++i)
+      worstNormalize = fmax(worstNormalize, fabs(got[i] - expected[i]) / ldexp(1.0, -23));
+
+    // the batched versions, four vectors at once
+    float v[4][4], w[4][4];
+    for (int j = 0; j < 4; ++j) {
+      randomVector(random, v[j]);
+      randomVector(random, w[j]);
+    }
+    Vec vs[4] = { toVec(v[0]), toVec(v[1]), toVec(v[2]), toVec(v[3]) };
+    Vec ws[4] = { toVec(w[0]), toVec(w[1]), toVec(w[2]), toVec(w[3]) };
+    float dots[4], lengths[4];
+    dot4(vs, ws, dots);
+    length4(vs, lengths);
+    for (int j = 0; j < 4; ++j) {
+      const float expectedDot = basicDot(v[j], w[j]);
+      CHECK(failures, fabsf(dots[j] - expectedDot) <= dotTolerance(v[j], w[j]),
+          "dot4 lane %d is %.9g, %.9g with BASIC_VECTORS", j, dots[j], expectedDot);
+      worstLength = fmax(worstLength, ulpDistance(lengths[j], basicLength(v[j])));
+    }
+    normalize4(vs);
+    for (int j = 0; j < 4; ++j) {
+      basicNormalize(v[j], expected);
+      vs[j].flatten(got);
+      for (int i = 0; i < 3; ++i)
+        worstNormalize = fmax(worstNormalize, fabs(got[i] - expected[i]) / ldexp(1.0, -23));
+    }
+  }
+  CHECK(failures, worstDivide <= 4.0, "/ is %g ulp off", worstDivide);
+  CHECK(failures, worstSqrt <= 4.0, "sqrt() is %g ulp off", worstSqrt);
+  CHECK(failures, worstLength <= 4.0, "length4 is %g ulp off", worstLength);
+  CHECK(failures, worstNormalize <= 4.0, "normalize is %g ulp of 1 off", worstNormalize);
+  return failures;
+}
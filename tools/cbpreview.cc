@@ -0,0 +1,120 @@
+// The reference viewer of cornellbox --preview: follows the stream (see
+// src/preview.hh) and rewrites a PPM with the frame after every update,
+// for an image viewer that reloads it. The file is replaced in one go, so
+// it's never seen half written.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "../src/preview.hh"
+#include "../src/clock.hh"
+
+namespace {
+
+uint32_t get16(const uint8_t *p) {
+  return p[0] | (p[1] << 8);
+}
+
+uint32_t get32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+// false at the end of the stream
+bool readAll(int fd, void *buffer, size_t bytes) {
+  uint8_t *p = static_cast<uint8_t*>(buffer);
+  while (bytes) {
+    const ssize_t n = read(fd, p, bytes);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    p += n;
+    bytes -= n;
+  }
+  return true;
+}
+
+bool writeFrame(const char *path, const uint8_t *frame, uint32_t w, uint32_t h) {
+  char temporary[1024];
+  snprintf(temporary, sizeof(temporary), "%s.part", path);
+  FILE *f = fopen(temporary, "wb");
+  if (!f) return false;
+  fprintf(f, "P6 %u %u 255 ", w, h);
+  const bool written = fwrite(frame, 3, static_cast<size_t>(w) * h, f) == static_cast<size_t>(w) * h;
+  return !fclose(f) && written && !rename(temporary, path);
+}
+
+}
+
+int main(int argc, char **argv) {
+  if (argc != 3) {
+    fprintf(stderr, "Usage: %s address preview.ppm\n", argv[0]);
+    fprintf(stderr, "  address is the one given to cornellbox --preview\n");
+    return 1;
+  }
+  const int fd = openPreviewSocket(argv[1], false);
+  if (fd < 0) return 1;
+  uint8_t hello[PreviewServer::helloSize];
+  if (!readAll(fd, hello, sizeof(hello)) || memcmp(hello, "CBP1", 4)) {
+    fprintf(stderr, "%s is not a cornellbox preview\n", argv[1]);
+    return 1;
+  }
+  const uint32_t w = get32(hello + 4), h = get32(hello + 8), tileSize = get32(hello + 12);
+  if (!w || !h || !tileSize || w > 65536 || h > 65536 || tileSize > 1024) {
+    fprintf(stderr, "Unexpected frame of %ux%u in tiles of %u\n", w, h, tileSize);
+    return 1;
+  }
+  uint8_t *frame = new uint8_t[static_cast<size_t>(w) * h * 3]();
+  const size_t tileBytes = static_cast<size_t>(tileSize) * tileSize * 3;
+  uint8_t *code = new uint8_t[maxEncodedBytes(tileBytes)];
+  uint8_t *delta = new uint8_t[tileBytes];
+  const double start = now();
+  uint64_t received = sizeof(hello);
+  int updates = 0;
+  bool ok = true;
+  uint8_t header[8];
+  while (ok && readAll(fd, header, 4)) {
+    const uint32_t tiles = get32(header);
+    received += 4;
+    for (uint32_t i = 0; ok && i < tiles; ++i) {
+      ok = readAll(fd, header, 8);
+      if (!ok) break;
+      const uint32_t tx = get16(header), ty = get16(header + 2), bytes = get32(header + 4);
+      const uint32_t x = tx * tileSize, y = ty * tileSize;
+      ok = x < w && y < h && bytes <= maxEncodedBytes(tileBytes) && readAll(fd, code, bytes);
+      if (!ok) break;
+      received += 8 + bytes;
+      const uint32_t tw = w - x < tileSize ? w - x : tileSize;
+      const uint32_t th = h - y < tileSize ? h - y : tileSize;
+      const size_t rowBytes = tw * 3;
+      ok = decodeRuns(code, bytes, delta, rowBytes * th);
+      for (uint32_t j = 0; ok && j < th; ++j) {
+        uint8_t *row = frame + (static_cast<size_t>(y + j) * w + x) * 3;
+        for (size_t k = 0; k < rowBytes; ++k) {
+          row[k] ^= delta[j * rowBytes + k];
+        }
+      }
+    }
+    if (!ok) break;
+    if (!writeFrame(argv[2], frame, w, h)) {
+      fprintf(stderr, "\nCould not write %s\n", argv[2]);
+      return 1;
+    }
+    ++updates;
+    const double elapsed = now() - start;
+    fprintf(stderr, "\rupdate %d, %3u tiles, %.1f KB/s ", updates, tiles,
+        received / 1024.0 / (elapsed > 1.0 ? elapsed : 1.0));
+  }
+  fprintf(stderr, "\n");
+  close(fd);
+  delete[] frame;
+  delete[] code;
+  delete[] delta;
+  if (!ok) {
+    fprintf(stderr, "The stream from %s is broken\n", argv[1]);
+    return 1;
+  }
+  fprintf(stderr, "The render ended, %d updates, %.1f KB\n", updates, received / 1024.0);
+  return 0;
+}
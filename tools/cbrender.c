@@ -0,0 +1,48 @@
+/* Renders a frame headless through libcornellbox and writes it as a
+   binary PPM, an example of the C API without SDL. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "../src/cornellbox.h"
+
+static int progress(cb_renderer *renderer, int passes, void *user) {
+  fprintf(stderr, "\rpass %d/%d, %d spp ", passes, *(const int*) user, cb_samples(renderer));
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  cb_settings settings;
+  cb_default_settings(&settings);
+  if (argc != 3 || sscanf(argv[1], "%dx%d", &settings.width, &settings.height) != 2) {
+    fprintf(stderr, "Usage: %s WxH SPP > image.ppm\n", argv[0]);
+    return 1;
+  }
+  const int spp = atoi(argv[2]);
+  int passes = (spp + settings.samples_per_pass - 1) / settings.samples_per_pass;
+  cb_renderer *renderer = cb_create(&settings);
+  if (!renderer) {
+    fprintf(stderr, "Could not create the renderer\n");
+    return 1;
+  }
+  if (cb_render_async(renderer, passes, progress, &passes) || cb_wait(renderer) != passes) {
+    fprintf(stderr, "Rendering failed\n");
+    cb_destroy(renderer);
+    return 1;
+  }
+  fprintf(stderr, "\n");
+  cb_image image;
+  cb_get_image(renderer, &image);
+  printf("P6 %d %d 255 ", image.width, image.height);
+  for (int y = 0; y < image.height; ++y) {
+    const uint8_t *pixel = image.pixels + y * image.stride;
+    for (int x = 0; x < image.width; ++x, pixel += 4) {
+      putchar(pixel[image.red_channel]);
+      putchar(pixel[1]);
+      putchar(pixel[2 - image.red_channel]);
+    }
+  }
+  cb_destroy(renderer);
+  return 0;
+}
@@ -0,0 +1,40 @@
+// Turns a tiled image written by cornellbox --poster into a binary PPM,
+// one band of tiles at a time, so it needs memory for a band only.
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "../src/tiledimage.hh"
+
+int main(int argc, char **argv) {
+  if (argc != 3) {
+    fprintf(stderr, "Usage: %s poster.cbt poster.ppm (- for stdout)\n", argv[0]);
+    return 1;
+  }
+  TiledImage image;
+  if (!image.open(argv[1])) {
+    fprintf(stderr, "%s is not a tiled image\n", argv[1]);
+    return 1;
+  }
+  const bool toStdout = argv[2][0] == '-' && !argv[2][1];
+  FILE *out = toStdout ? stdout : fopen(argv[2], "wb");
+  if (!out) {
+    fprintf(stderr, "Could not create %s\n", argv[2]);
+    return 1;
+  }
+  const size_t bandBytes = static_cast<size_t>(image.getWidth()) * image.getTileSize() * 3;
+  uint8_t *band = new uint8_t[bandBytes];
+  fprintf(out, "P6 %u %u 255 ", image.getWidth(), image.getHeight());
+  bool ok = true;
+  for (uint32_t ty = 0; ok && ty < image.tilesY(); ++ty) {
+    const size_t bytes = static_cast<size_t>(image.getWidth()) * image.tileHeight(ty) * 3;
+    ok = image.readBand(ty, band) && fwrite(band, 1, bytes, out) == bytes;
+  }
+  delete[] band;
+  if (!toStdout) ok = !fclose(out) && ok;
+  if (!ok) {
+    fprintf(stderr, "Could not convert %s\n", argv[1]);
+    return 1;
+  }
+  return 0;
+}